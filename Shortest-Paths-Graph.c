@@ -1,303 +1,547 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
-#include <limits.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 
-#define INF INT_MAX
-#define MAX_LINES 20000
-#define MAX_WEIGHTS 10
-#define ADDON MAX_WEIGHTS
+#include "shortestpaths.h"
 
-typedef struct
-{
-    int vs; // Vertex source (starting vertex)
-    int vt; // Vertex target (ending vertex)
-    int weights[MAX_WEIGHTS]; // Edge weights
-} Edge;
+#define BENCH_SECONDS 2 // Duration of the --bench-rw benchmark
+#define OOC_CACHE_MB 64 // Default block cache of --ooc
 
-typedef struct
+void print_path(const int *path, int length)
 {
-    int V; // Number of vertices in the graph
-    int N; // Number of edge weights
-    Edge edges[MAX_LINES]; // Array of edges
-    int edge_num; // Number of edges
-} Data;
+    for (int i = 0; i < length; i++)
+    {
+        printf("%d ", path[i]);
+    }
 
-typedef struct
+    printf("\n");
+}
+
+double now_seconds()
 {
-    int vertex; // Vertex number
-    int distance; // Current shortest distance from vs to vt
-    int step; // Step counter
-} Node;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
 
 typedef struct
 {
-    Node *arr; // Array of nodes
-    int curr_size; // Current number of minheap elements
-    int capacity; // Maximum minheap capacity (max_size)
-} Heap;
-
-Heap* build_heap(int max_size)
+    sp_graph* graph; // Shared graph
+    const int *queries; // source, dest pairs (graph file ids)
+    int num_queries; // Number of pairs
+    int first; // Query this thread starts at
+    atomic_int *stop; // Set when the benchmark is over
+    long done; // Queries answered (reader) or updates applied (writer)
+    double latency; // Total update latency in seconds (writer)
+    double max_latency; // Slowest update in seconds (writer)
+} BenchThread;
+
+void* bench_reader(void *arg)
 {
-    // Initalize and allocate memory
-    Heap* heap = (Heap*)malloc(sizeof(Heap));
-    heap->curr_size = 0;
-    heap->capacity = max_size;
-    heap->arr = (Node*)malloc(max_size * sizeof(Node));
-
-    if (heap == NULL || heap->arr == NULL)
+    BenchThread* t = (BenchThread*)arg;
+    sp_query* query = sp_query_create(t->graph);
+    int capacity = SP_MAX_PATH(sp_graph_vertices(t->graph));
+    int *path = (int*)malloc(capacity * sizeof(int));
+    int distance;
+    int length;
+
+    for (int i = t->first; !atomic_load(t->stop); i = (i + 1) % t->num_queries)
     {
-        printf("Memory error!\n");
-        return(NULL);
+        sp_query_path(query, t->queries[2 * i], t->queries[2 * i + 1], &distance, path, capacity, &length);
+        t->done++;
     }
 
-    return(heap);
+    free(path);
+    sp_query_free(query);
+    return(NULL);
 }
 
-void heapify(Heap* heap, int ind)
+void* bench_writer(void *arg)
 {
-    int left_child = (ind * 2) + 1;
-    int right_child = (ind * 2) + 2;
-    int min = ind;
-
-    if (left_child < heap->curr_size) // Is left_child in range
+    // Keep rewriting the weights of random existing edges
+    BenchThread* t = (BenchThread*)arg;
+    int V = sp_graph_vertices(t->graph);
+    int N = sp_graph_weights(t->graph);
+    int capacity = 16;
+    int *targets = (int*)malloc(capacity * sizeof(int));
+    int *weights = (int*)malloc(capacity * N * sizeof(int));
+    unsigned int seed = 1;
+
+    while (!atomic_load(t->stop))
     {
-        if (heap->arr[left_child].distance < heap->arr[min].distance) // Is left_child smaller than ind
+        int vs = rand_r(&seed) % V;
+        int count = sp_graph_out_edges(t->graph, vs, targets, weights, capacity);
+        if (count > capacity)
         {
-            min = left_child; // left_child is minimum index
+            capacity = count;
+            targets = (int*)realloc(targets, capacity * sizeof(int));
+            weights = (int*)realloc(weights, capacity * N * sizeof(int));
+            continue;
+        }
+        if (count <= 0)
+        {
+            continue;
         }
-    }
 
-    if (right_child < heap->curr_size) // Is right_child in range
-    {
-        if (heap->arr[right_child].distance < heap->arr[min].distance) // Is right_child smaller than min
+        int e = rand_r(&seed) % count;
+        int *edge_weights = weights + e * N;
+        for (int j = 0; j < N; j++)
         {
-            min = right_child; // right_child is minimum index
+            edge_weights[j] = edge_weights[j] / 2 + rand_r(&seed) % (edge_weights[j] + 1); // Stay near the old weight
         }
-    }
 
-    if (min != ind)
-    {
-        // Swap heap->arr[min] and heap->arr[ind]
-        Node temp = heap->arr[min];
-        heap->arr[min] = heap->arr[ind];
-        heap->arr[ind] = temp;
-        
-        heapify(heap, min); // rerun function with min instead of ind
+        double start = now_seconds();
+        sp_graph_set_edge(t->graph, vs, targets[e], edge_weights);
+        double elapsed = now_seconds() - start;
+
+        t->latency += elapsed;
+        if (elapsed > t->max_latency)
+        {
+            t->max_latency = elapsed;
+        }
+        t->done++;
     }
+
+    free(targets);
+    free(weights);
+    return(NULL);
 }
 
-Node extract_min(Heap* heap)
+int* read_queries(int *num_queries)
 {
-    if (heap->curr_size == 0)
+    // Every "source dest" pair on stdin, for the benchmarks
+    int capacity = 64;
+    int *queries = (int*)malloc(2 * capacity * sizeof(int));
+    int source;
+    int dest;
+    *num_queries = 0;
+    while (scanf("%d %d", &source, &dest) == 2)
     {
-        printf("Minheap empty\n");
-        Node null = {-INF, INF, -INF};
-        return(null);
+        if (*num_queries == capacity)
+        {
+            capacity *= 2;
+            queries = (int*)realloc(queries, 2 * capacity * sizeof(int));
+        }
+        queries[2 * *num_queries] = source;
+        queries[2 * *num_queries + 1] = dest;
+        (*num_queries)++;
     }
 
-    Node extract_root = heap->arr[0]; // Extract min element (min at root of minheap)
+    return(queries);
+}
 
-    // Just in case heap is just the root
-    if (heap->curr_size == 1)
+void run_rw_benchmark(sp_graph* graph, int num_readers)
+{
+    // Mixed benchmark: num_readers query threads against one writer for BENCH_SECONDS
+    int num_queries;
+    int *queries = read_queries(&num_queries);
+    if (num_queries == 0)
     {
-        (heap->curr_size)--;
-        return(extract_root);
+        fprintf(stderr, "No queries for the benchmark\n");
+        free(queries);
+        return;
     }
 
-    // Put last_node at root of minheap
-    int end = (heap->curr_size) - 1;
-    Node last_node = heap->arr[end];
-    heap->arr[0] = last_node; // Replacement
-
-    (heap->curr_size)--; // Decrease size of minheap (remove 2nd instance of last_node)
-    heapify(heap, 0); // Rebalance minheap
+    atomic_int stop;
+    atomic_init(&stop, 0);
+    pthread_t threads[num_readers + 1];
+    BenchThread args[num_readers + 1];
+    for (int i = 0; i <= num_readers; i++)
+    {
+        BenchThread t = {graph, queries, num_queries, (i * num_queries) / (num_readers + 1), &stop, 0, 0.0, 0.0};
+        args[i] = t;
+        pthread_create(&threads[i], NULL, (i < num_readers) ? bench_reader : bench_writer, &args[i]);
+    }
 
-    return(extract_root);
-}
+    struct timespec duration = {BENCH_SECONDS, 0};
+    nanosleep(&duration, NULL);
+    atomic_store(&stop, 1);
 
-void decrease_key(Heap* heap, int vertex_to_update, int new_distance, int new_step)
-{
-    // Find index of vertex_to_update
-    int ind = -1;
-    for (int i = 0; i < heap->curr_size; i++)
+    long total_queries = 0;
+    for (int i = 0; i <= num_readers; i++)
     {
-        if (heap->arr[i].vertex == vertex_to_update)
+        pthread_join(threads[i], NULL);
+        if (i < num_readers)
         {
-            ind = i;
-            break;
+            total_queries += args[i].done;
         }
     }
 
-    // Check if vertex is in heap
-    if (ind == -1 || ind >= heap->curr_size)
+    BenchThread* writer = &args[num_readers];
+    printf("readers: %d queries: %ld (%.1f/s)\n", num_readers, total_queries, (double)total_queries / BENCH_SECONDS);
+    printf("updates: %ld (%.1f/s) avg latency: %.1f us max latency: %.1f us\n", writer->done, (double)writer->done / BENCH_SECONDS,
+           writer->done ? 1e6 * writer->latency / writer->done : 0.0, 1e6 * writer->max_latency);
+
+    free(queries);
+}
+
+void run_shard_benchmark(sp_graph* graph, int max_shards)
+{
+    // The stdin queries once with sp_query_path, then with 1 .. max_shards worker processes
+    // (start-up not timed). Scaling is reported against one shard: it cannot exceed the shard
+    // count or the number of CPUs.
+    int num_queries;
+    int *queries = read_queries(&num_queries);
+    if (num_queries == 0)
     {
+        fprintf(stderr, "No queries for the benchmark\n");
+        free(queries);
         return;
     }
 
-    // Update distance and step of vertex_to_update
-    heap->arr[ind].distance = new_distance;
-    heap->arr[ind].step = new_step;
+    int capacity = SP_MAX_PATH(sp_graph_vertices(graph));
+    int *path = (int*)malloc(capacity * sizeof(int));
+    int distance;
+    int length;
+    printf("cpus: %ld queries: %d\n", sysconf(_SC_NPROCESSORS_ONLN), num_queries);
+
+    sp_query* query = sp_query_create(graph);
+    double start = now_seconds();
+    for (int q = 0; q < num_queries; q++)
+    {
+        sp_query_path(query, queries[2 * q], queries[2 * q + 1], &distance, path, capacity, &length);
+    }
+    double serial = now_seconds() - start;
+    sp_query_free(query);
+    printf("serial: %.3f s (%.1f queries/s)\n", serial, num_queries / serial);
 
-    while (ind > 0)
+    double one_shard = 0.0;
+    for (int k = 1; k <= max_shards; k++)
     {
-        int parent_ind = (ind - 1) / 2; // Parent index
-        if (heap->arr[ind].distance >= heap->arr[parent_ind].distance) // Check if minheap property is violated
+        int status;
+        sp_shards* shards = sp_shards_start(graph, k, &status);
+        if (shards == NULL)
         {
+            fprintf(stderr, "Error starting shards (%d)\n", status);
             break;
         }
-        else
-        {
-            // Swap heap->arr[ind] and heap->arr[ind / 2]
-            Node temp = heap->arr[ind];
-            heap->arr[ind] = heap->arr[parent_ind];
-            heap->arr[parent_ind] = temp;
 
-            ind = parent_ind;
+        start = now_seconds();
+        for (int q = 0; q < num_queries && status != SP_ERR_WORKER; q++)
+        {
+            status = sp_shards_path(shards, queries[2 * q], queries[2 * q + 1], &distance, path, capacity, &length);
         }
+        double elapsed = now_seconds() - start;
+        sp_shards_stop(shards);
+        if (status == SP_ERR_WORKER)
+        {
+            fprintf(stderr, "Error: a shard worker died\n");
+            break;
+        }
+        one_shard = (k == 1) ? elapsed : one_shard;
+        printf("shards %d: %.3f s (%.1f queries/s, %.2fx one shard)\n", k, elapsed, num_queries / elapsed, one_shard / elapsed);
     }
+
+    free(path);
+    free(queries);
 }
 
-void dijkstra(int source, int destination, Data data)
+void run_range_queries(sp_query* query, int V)
 {
-    int distance[data.V][ADDON]; // 2D array of distances between vertices (cumulative weights)
-    int previous[data.V][ADDON]; // Array to track the path
-    int visited[data.V][ADDON]; // Visited / Explored vertices
+    // One line per "source budget" query: vertex:distance:step for every vertex within budget
+    int *vertices = (int*)malloc(V * sizeof(int));
+    int *distances = (int*)malloc(V * sizeof(int));
+    int *steps = (int*)malloc(V * sizeof(int));
+    int source;
+    int budget;
+    int count;
 
-    for (int i = 0; i < data.V; i++)
+    while (scanf("%d %d", &source, &budget) == 2)
     {
-        for (int j = 0; j < ADDON; j++)
+        if (sp_query_range(query, source, budget, vertices, distances, steps, V, &count) == SP_OK)
         {
-            distance[i][j] = INF; // Initialize distances 2D array
-            visited[i][j] = 0; // Initialize visited / explored vertices
-            previous[i][j] = -1; // Initialize previous array
+            for (int i = 0; i < count; i++)
+            {
+                printf("%d:%d:%d ", vertices[i], distances[i], steps[i]);
+            }
+
+            printf("\n");
         }
     }
 
-    distance[source][0] = 0; // Initialize source to have 0 distance
+    free(vertices);
+    free(distances);
+    free(steps);
+}
 
-    Heap* minheap = build_heap(data.V * ADDON); // Create minheap
+int run_out_of_core(const char *store_file, int cache_mb)
+{
+    // Same output as the in-memory mode, plus the I/O of each query on stderr
+    int status;
+    sp_ooc* ooc = sp_ooc_open(store_file, (size_t)cache_mb << 20, &status);
+    if (ooc == NULL)
+    {
+        fprintf(stderr, "Error opening store (%d)\n", status);
+        return(EXIT_FAILURE);
+    }
 
-    // Populate minheap
-    for (int i = 0; i < data.V; i++)
+    int source;
+    int dest;
+    int distance;
+    int length;
+    int capacity = 1024;
+    int *path = (int*)malloc(capacity * sizeof(int));
+    sp_io_stats io;
+    memset(&io, 0, sizeof(io));
+    while (scanf("%d %d", &source, &dest) == 2) // User input
     {
-        for (int j = 0; j < ADDON; j++)
+        status = sp_ooc_path(ooc, source, dest, &distance, path, capacity, &length, &io);
+        if (status == SP_ERR_BUFFER) // Rare: grow and ask again
         {
-            Node node = {i * ADDON + j, distance[i][j], j};
-            minheap->arr[i * ADDON + j] = node;
-            (minheap->curr_size)++;
+            capacity = length;
+            path = (int*)realloc(path, capacity * sizeof(int));
+            status = sp_ooc_path(ooc, source, dest, &distance, path, capacity, &length, NULL);
         }
+
+        if (status != SP_OK)
+        {
+            continue; // Vertex out of range: no path and no I/O to report
+        }
+
+        if (distance != SP_INF)
+        {
+            print_path(path, length);
+        }
+        fprintf(stderr, "io: %ld reads (%ld prefetched) %lld bytes, %ld hits %ld misses\n", io.reads, io.prefetched, io.bytes_read, io.hits, io.misses);
     }
 
-    // Initialize source vertex in minheap with a distance of 0 and step 0
-    decrease_key(minheap, source * ADDON, 0, 0);
+    free(path);
+    sp_ooc_close(ooc);
+    return(EXIT_SUCCESS);
+}
 
-    while (minheap->curr_size > 0)
+int main(int argc, char *argv[])
+{
+    // Usage: pa3 graph.txt [--order=bfs|rcm|degree] [--compress] [--stats] [--bench-rw=READERS | --bench-shards=MAX] [--profile | --range | --shards=K | --alternatives=K [--threads=T]]
+    //        pa3 graph.txt --ooc-build=STORE [--order=degree]
+    //        pa3 STORE --ooc[=CACHE_MB]
+    int order = SP_ORDER_NONE;
+    const char *ooc_build = NULL;
+    int ooc_cache_mb = 0;
+    int compress = 0;
+    int stats = 0;
+    int bench_readers = 0;
+    int bench_shards = 0;
+    int profile_mode = 0;
+    int range_mode = 0;
+    int num_shards = 0;
+    int alternatives = 0;
+    int threads = 0;
+    for (int i = 2; i < argc; i++)
     {
-        // Get root (smallest value) of minheap
-        Node minNode = extract_min(minheap);
-        int u = minNode.vertex / ADDON;
-        int curr_step = minNode.step;
-
-        for (int i = 0; i < data.edge_num; i++)
+        if (strcmp(argv[i], "--order=bfs") == 0)
         {
-            if (data.edges[i].vs == u)
-            {
-                // Update comparison values
-                int v = data.edges[i].vt;
-                int weight = data.edges[i].weights[minNode.step % data.N];
-                int next_step = (curr_step + 1) % ADDON;
-                if (distance[u][curr_step] != INF && distance[u][curr_step] + weight < distance[v][next_step]) // Progress to next vertex
-                {
-                    distance[v][next_step] = distance[u][curr_step] + weight; // Distance from source increases
-                    previous[v][next_step] = u * ADDON + curr_step; // Path backtracking
-                    decrease_key(minheap, v * ADDON + next_step, distance[v][next_step], next_step); // Update the distance and step of vertex in minheap with newly calculated shortest distance
-                }
-            }
+            order = SP_ORDER_BFS;
+        }
+        else if (strcmp(argv[i], "--order=rcm") == 0)
+        {
+            order = SP_ORDER_RCM;
+        }
+        else if (strcmp(argv[i], "--order=degree") == 0)
+        {
+            order = SP_ORDER_DEGREE;
+        }
+        else if (strcmp(argv[i], "--compress") == 0)
+        {
+            compress = SP_COMPRESS;
+        }
+        else if (strcmp(argv[i], "--stats") == 0)
+        {
+            stats = 1; // Adjacency size on stderr
+        }
+        else if (strncmp(argv[i], "--ooc-build=", 12) == 0)
+        {
+            ooc_build = argv[i] + 12;
+        }
+        else if (strcmp(argv[i], "--ooc") == 0)
+        {
+            ooc_cache_mb = OOC_CACHE_MB;
+        }
+        else if (sscanf(argv[i], "--ooc=%d", &ooc_cache_mb) == 1 && ooc_cache_mb > 0)
+        {
+            continue;
+        }
+        else if (strcmp(argv[i], "--profile") == 0)
+        {
+            profile_mode = 1; // All start phases per query
+        }
+        else if (strcmp(argv[i], "--range") == 0)
+        {
+            range_mode = 1; // Queries are "source budget"
+        }
+        else if (sscanf(argv[i], "--shards=%d", &num_shards) == 1 && num_shards > 0 && num_shards <= SP_MAX_SHARDS)
+        {
+            continue; // Queries run on worker processes
+        }
+        else if (sscanf(argv[i], "--alternatives=%d", &alternatives) == 1 && alternatives > 0)
+        {
+            continue; // k shortest paths per query
+        }
+        else if (sscanf(argv[i], "--threads=%d", &threads) == 1 && threads > 0 && threads <= SP_MAX_THREADS)
+        {
+            continue; // Spur search threads, whatever the CPU count
+        }
+        else if (sscanf(argv[i], "--bench-rw=%d", &bench_readers) == 1 && bench_readers > 0)
+        {
+            continue;
+        }
+        else if (sscanf(argv[i], "--bench-shards=%d", &bench_shards) == 1 && bench_shards > 0 && bench_shards <= SP_MAX_SHARDS)
+        {
+            continue;
+        }
+        else
+        {
+            argc = 0; // Unknown option
         }
     }
 
-    // Find the minimum distance and steps to the destination considering all steps
-    int min_dist = INF;
-    int min_step = -1;
-    for (int step = 0; step < ADDON; step++)
+    if (argc < 2)
     {
-        if (distance[destination][step] < min_dist)
+        fprintf(stderr, "ERROR!\n", argv[0]);
+        return(EXIT_FAILURE);
+    }
+
+    int status;
+    if (ooc_build != NULL)
+    {
+        status = sp_ooc_build(argv[1], ooc_build, order);
+        if (status != SP_OK)
         {
-            min_dist = distance[destination][step];
-            min_step = step;
+            fprintf(stderr, "Error building store (%d)\n", status);
+            return(EXIT_FAILURE);
         }
+        return(EXIT_SUCCESS);
     }
 
-    // Print shortest path
-    if (min_dist != INF)
+    if (ooc_cache_mb > 0)
     {
-        int path[2 * ADDON];
-        int path_index = 0;
-        int current_node = destination * ADDON + min_step;
+        return(run_out_of_core(argv[1], ooc_cache_mb));
+    }
 
-        while (current_node != -1)
+    sp_graph* graph = sp_graph_load(argv[1], order | compress, &status); // Read data_file
+    if (graph == NULL)
+    {
+        if (status == SP_ERR_IO)
         {
-            path[path_index++] = current_node / ADDON;
-            current_node = previous[current_node / MAX_WEIGHTS][current_node % MAX_WEIGHTS];
+            perror("Error opening file");
         }
-
-        for (int i = path_index - 1; i >= 0; i--)
+        else
         {
-            printf("%d ", path[i]);
+            fprintf(stderr, "Error reading graph (%d)\n", status);
         }
-        
-        printf("\n");
+        return(EXIT_FAILURE);
     }
 
-    // Free minheap and array
-    free(minheap->arr);
-    free(minheap);
-}
+    if (stats)
+    {
+        fprintf(stderr, "adjacency: %zu bytes\n", sp_graph_adjacency_bytes(graph));
+    }
 
-Data read_data(const char *filename)
-{
-    FILE *data_file = fopen(filename, "r");
-    if (data_file == NULL)
+    if (bench_readers > 0)
     {
-        perror("Error opening file");
-        exit(EXIT_FAILURE);
+        run_rw_benchmark(graph, bench_readers);
+        sp_graph_free(graph);
+        return(EXIT_SUCCESS);
     }
 
-    Data data;
-    fscanf(data_file, "%d %d", &data.V, &data.N); // Read V (num of vertices) and N (num of weights)
+    if (bench_shards > 0)
+    {
+        run_shard_benchmark(graph, bench_shards);
+        sp_graph_free(graph);
+        return(EXIT_SUCCESS);
+    }
 
-    int i = 0;
-    data.edge_num = 0;
-    while (fscanf(data_file, "%d %d", &data.edges[i].vs, &data.edges[i].vt) == 2) // Read vertex sources and targets
+    sp_shards* shards = NULL;
+    if (num_shards > 0)
     {
-        data.edge_num++;
-        for (int j = 0; j < data.N; j++)
+        shards = sp_shards_start(graph, num_shards, &status);
+        if (shards == NULL)
         {
-            fscanf(data_file, "%d", &data.edges[i].weights[j]); // Read weights
+            fprintf(stderr, "Error starting shards (%d)\n", status);
+            sp_graph_free(graph);
+            return(EXIT_FAILURE);
         }
-        i++;
     }
 
-    fclose(data_file);
-    return(data);
-}
+    sp_query* query = sp_query_create(graph);
+    sp_query_set_threads(query, threads);
+    int n = sp_graph_weights(graph);
+    int capacity = SP_MAX_PATH(sp_graph_vertices(graph));
+    int lanes = (alternatives > n) ? alternatives : n; // Paths written per query
+    int *paths = (int*)malloc((size_t)lanes * capacity * sizeof(int));
+    int *distances = (int*)malloc(lanes * sizeof(int));
+    int *lengths = (int*)malloc(lanes * sizeof(int));
 
-int main(int argc, char *argv[])
-{
-    if (argc != 2)
+    if (range_mode)
     {
-        fprintf(stderr, "ERROR!\n", argv[0]);
-        return(EXIT_FAILURE);
+        run_range_queries(query, sp_graph_vertices(graph));
+        free(paths);
+        free(distances);
+        free(lengths);
+        sp_query_free(query);
+        sp_graph_free(graph);
+        return(EXIT_SUCCESS);
     }
 
-    Data data = read_data(argv[1]); // Read data_file
-
     int source;
     int dest;
     while (scanf("%d %d", &source, &dest) == 2) // User input
     {
-        dijkstra(source, dest, data); // Dijkstra's algorithm
+        if (profile_mode)
+        {
+            // One line per start phase: phase, distance (-1 if unreachable), path
+            if (sp_query_profile(query, source, dest, distances, paths, capacity, lengths) == SP_OK)
+            {
+                for (int p = 0; p < n; p++)
+                {
+                    printf("%d %d: ", p, (distances[p] == SP_INF) ? -1 : distances[p]);
+                    print_path(paths + p * capacity, lengths[p]);
+                }
+            }
+        }
+        else if (alternatives > 0)
+        {
+            // One line per alternative: rank, distance, path
+            int count;
+            if (sp_query_k_paths(query, source, dest, alternatives, distances, paths, capacity, lengths, &count) == SP_OK)
+            {
+                for (int p = 0; p < count; p++)
+                {
+                    printf("%d %d: ", p, distances[p]);
+                    print_path(paths + p * capacity, lengths[p]);
+                }
+            }
+        }
+        else if (shards != NULL)
+        {
+            status = sp_shards_path(shards, source, dest, &distances[0], paths, capacity, &lengths[0]);
+            if (status == SP_ERR_WORKER)
+            {
+                fprintf(stderr, "Error: a shard worker died\n");
+                break;
+            }
+            if (status == SP_OK && distances[0] != SP_INF)
+            {
+                print_path(paths, lengths[0]);
+            }
+        }
+        else if (sp_query_path(query, source, dest, &distances[0], paths, capacity, &lengths[0]) == SP_OK && distances[0] != SP_INF)
+        {
+            print_path(paths, lengths[0]); // Print shortest path (nothing if unreachable)
+        }
     }
 
-    return(EXIT_SUCCESS);
-}
\ No newline at end of file
+    free(paths);
+    free(distances);
+    free(lengths);
+    sp_shards_stop(shards);
+    sp_query_free(query);
+    sp_graph_free(graph);
+    return((status == SP_ERR_WORKER) ? EXIT_FAILURE : EXIT_SUCCESS);
+}
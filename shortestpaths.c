@@ -0,0 +1,4383 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "shortestpaths.h"
+
+#define INF SP_INF
+#define MAX_LINES 20000
+#define MAX_WEIGHTS SP_MAX_WEIGHTS
+#define ADDON MAX_WEIGHTS
+#define ADJ_BLOCK 64 // Vertices per adjacency block (the unit copied on write)
+
+typedef struct
+{
+    int vs; // Vertex source (starting vertex)
+    int vt; // Vertex target (ending vertex)
+    int weights[MAX_WEIGHTS]; // Edge weights
+} Edge;
+
+// Adjacency of ADJ_BLOCK consecutive vertices. Plain blocks store Edge records. Compressed blocks
+// (SP_COMPRESS) reuse the edges storage as bytes: the targets of each vertex as zigzag varint
+// deltas (the first one relative to the source vertex), then one bit-packed column per weight
+// index holding weight - weight_base in weight_bits bits.
+typedef struct
+{
+    atomic_int refs; // Number of graph versions sharing this block
+    int edge_num; // Number of edges in the block
+    int bytes; // Size of the edges storage
+    int start[ADJ_BLOCK + 1]; // Edges of the k-th vertex of the block are edges[start[k]] .. edges[start[k + 1] - 1]
+    int target_start[ADJ_BLOCK + 1]; // Compressed: first target byte of the k-th vertex
+    int weight_offset; // Compressed: first byte of the weight columns
+    int weight_base; // Compressed: smallest weight in the block
+    int weight_bits; // Compressed: width of a packed weight
+    uint64_t weight_mask; // Compressed: (1 << weight_bits) - 1
+    Edge edges[]; // Edges grouped by source vertex
+} AdjBlock;
+
+typedef struct Data Data;
+typedef void (*SearchFn)(int source, const Data* data, sp_query* query);
+typedef void (*ProfileFn)(int source, const Data* data, sp_query* query);
+typedef int (*RangeFn)(int source, int budget, const Data* data, sp_query* query, int *vertices, int *distances, int *steps, int capacity);
+
+// One immutable version of the graph. Versions are published through a GraphStore and
+// share every adjacency block that an update did not touch.
+struct Data
+{
+    int V; // Number of vertices in the graph
+    int N; // Number of edge weights
+    Edge *edges; // Array of edges (only while loading, NULL afterwards)
+    int edge_num; // Number of edges
+    AdjBlock **blocks; // Adjacency of vertex u is in blocks[u / ADJ_BLOCK]
+    int packed; // Blocks are compressed (SP_COMPRESS)
+    int num_blocks; // Number of adjacency blocks
+    int *old_to_new; // Graph file id -> internal id (NULL if vertices were not reordered)
+    int *new_to_old; // Internal id -> graph file id (NULL if vertices were not reordered)
+    SearchFn search; // Search kernel specialised for N (see select_kernels)
+    ProfileFn profile; // All-start-phase kernel specialised for N (see select_kernels)
+    RangeFn range; // Bounded-budget kernel specialised for N (see select_kernels)
+    atomic_int refs; // References held by the store and by in-flight queries
+    long version; // Number of updates applied since loading
+};
+
+typedef struct
+{
+    Data *_Atomic current; // Latest published version
+    atomic_int epoch; // Which readers counter new readers enter (0 or 1)
+    atomic_int readers[2]; // Readers between loading current and taking their reference
+    pthread_mutex_t write_lock; // Serialises writers
+} GraphStore;
+
+struct sp_graph
+{
+    GraphStore store; // Published versions
+    int V; // Number of vertices (the same in every version)
+    int N; // Number of edge weights (the same in every version)
+};
+
+typedef struct
+{
+    int vertex; // Vertex number
+    int distance; // Current shortest distance from vs to vt
+    int step; // Step counter
+    int hops; // Tie-break between equal distances: edges from the source (0 where unused)
+} Node;
+
+typedef struct
+{
+    Node *arr; // Array of nodes
+    int curr_size; // Current number of minheap elements
+    int capacity; // Maximum minheap capacity (max_size)
+} Heap;
+
+#define KSP_THREADS SP_MAX_THREADS // Most spur searches of a k-paths query running at once
+
+typedef struct
+{
+    int *g; // Distance from the source of every reached state
+    int *parent; // Predecessor of every reached state
+    int *seen; // generation once g and parent are valid
+    int *blocked; // generation if the state is on the root path
+    int generation; // Current spur search, so the stamps never need clearing
+    Heap *heap; // A* frontier (lazy deletion)
+} KspScratch;
+
+struct sp_query
+{
+    sp_graph *graph; // Graph this context queries
+    int states; // V * ADDON, enough states for every kernel
+    int *distance; // Distance of every state after the last search
+    int *previous; // Predecessor state of every state after the last search (-1 for none)
+    int *hops; // Edges on the path to every state after the last search
+    Heap *minheap; // Priority queue reused across queries
+    int *lane_distance; // Profile lanes (states * N, allocated by the first profile query)
+    int *lane_previous; // Profile predecessor lanes
+    int *lane_hops; // Profile edge count lanes (equal distances prefer fewer)
+    int *pending; // Profile: smallest lane improved since the state was last expanded
+    int *state_stamp; // Range: 2 * generation if the state is queued, 2 * generation + 1 once settled
+    int *vertex_stamp; // Range: generation once the vertex has been reported
+    int generation; // Range: current query number, so the stamps never need clearing
+    int *rev_start; // k paths: incoming edges of v are rev_source[rev_start[v] .. rev_start[v + 1] - 1]
+    int *rev_source; // k paths: source vertex of each incoming edge
+    int *rev_weights; // k paths: the N weights of each incoming edge
+    long rev_version; // k paths: graph version the reverse adjacency was built from (-1 for none)
+    int *bound; // k paths: distance from every state to the destination (INF if it cannot reach it)
+    int threads; // k paths: spur search threads (0 for one per CPU)
+    KspScratch ksp[KSP_THREADS]; // k paths: spur search scratch of each thread (allocated on first use)
+};
+
+Heap* build_heap(int max_size)
+{
+    // Initalize and allocate memory (NULL if out of memory)
+    Heap* heap = (Heap*)malloc(sizeof(Heap));
+    if (heap == NULL)
+    {
+        return(NULL);
+    }
+
+    heap->curr_size = 0;
+    heap->capacity = max_size;
+    heap->arr = (Node*)malloc(max_size * sizeof(Node));
+    if (heap->arr == NULL)
+    {
+        free(heap);
+        return(NULL);
+    }
+
+    return(heap);
+}
+
+static inline int node_less(const Node* a, const Node* b)
+{
+    // Heap order: distance, then hops
+    return(a->distance < b->distance || (a->distance == b->distance && a->hops < b->hops));
+}
+
+void heapify(Heap* heap, int ind)
+{
+    int left_child = (ind * 2) + 1;
+    int right_child = (ind * 2) + 2;
+    int min = ind;
+
+    if (left_child < heap->curr_size) // Is left_child in range
+    {
+        if (node_less(&heap->arr[left_child], &heap->arr[min])) // Is left_child smaller than ind
+        {
+            min = left_child; // left_child is minimum index
+        }
+    }
+
+    if (right_child < heap->curr_size) // Is right_child in range
+    {
+        if (node_less(&heap->arr[right_child], &heap->arr[min])) // Is right_child smaller than min
+        {
+            min = right_child; // right_child is minimum index
+        }
+    }
+
+    if (min != ind)
+    {
+        // Swap heap->arr[min] and heap->arr[ind]
+        Node temp = heap->arr[min];
+        heap->arr[min] = heap->arr[ind];
+        heap->arr[ind] = temp;
+        
+        heapify(heap, min); // rerun function with min instead of ind
+    }
+}
+
+Node extract_min(Heap* heap)
+{
+    if (heap->curr_size == 0)
+    {
+        Node null = {-INF, INF, -INF};
+        return(null);
+    }
+
+    Node extract_root = heap->arr[0]; // Extract min element (min at root of minheap)
+
+    // Just in case heap is just the root
+    if (heap->curr_size == 1)
+    {
+        (heap->curr_size)--;
+        return(extract_root);
+    }
+
+    // Put last_node at root of minheap
+    int end = (heap->curr_size) - 1;
+    Node last_node = heap->arr[end];
+    heap->arr[0] = last_node; // Replacement
+
+    (heap->curr_size)--; // Decrease size of minheap (remove 2nd instance of last_node)
+    heapify(heap, 0); // Rebalance minheap
+
+    return(extract_root);
+}
+
+void decrease_key(Heap* heap, int vertex_to_update, int new_distance, int new_step, int new_hops)
+{
+    // Find index of vertex_to_update
+    int ind = -1;
+    for (int i = 0; i < heap->curr_size; i++)
+    {
+        if (heap->arr[i].vertex == vertex_to_update)
+        {
+            ind = i;
+            break;
+        }
+    }
+
+    // Check if vertex is in heap
+    if (ind == -1 || ind >= heap->curr_size)
+    {
+        return;
+    }
+
+    // Update distance and step of vertex_to_update
+    heap->arr[ind].distance = new_distance;
+    heap->arr[ind].step = new_step;
+    heap->arr[ind].hops = new_hops;
+
+    while (ind > 0)
+    {
+        int parent_ind = (ind - 1) / 2; // Parent index
+        if (!node_less(&heap->arr[ind], &heap->arr[parent_ind])) // Check if minheap property is violated
+        {
+            break;
+        }
+        else
+        {
+            // Swap heap->arr[ind] and heap->arr[ind / 2]
+            Node temp = heap->arr[ind];
+            heap->arr[ind] = heap->arr[parent_ind];
+            heap->arr[parent_ind] = temp;
+
+            ind = parent_ind;
+        }
+    }
+}
+
+int insert_node(Heap* heap, Node node)
+{
+    // Append node and move it up until the minheap property holds. Returns SP_ERR_MEMORY
+    // (heap unchanged) if the heap is full and cannot grow.
+    if (heap->curr_size == heap->capacity) // Lazy-deletion searches may queue a state more than once
+    {
+        Node *grown = (Node*)realloc(heap->arr, 2 * heap->capacity * sizeof(Node));
+        if (grown == NULL)
+        {
+            return(SP_ERR_MEMORY);
+        }
+        heap->arr = grown;
+        heap->capacity *= 2;
+    }
+
+    int ind = heap->curr_size;
+    heap->arr[ind] = node;
+    (heap->curr_size)++;
+
+    while (ind > 0)
+    {
+        int parent_ind = (ind - 1) / 2; // Parent index
+        if (!node_less(&heap->arr[ind], &heap->arr[parent_ind]))
+        {
+            break;
+        }
+
+        Node temp = heap->arr[ind];
+        heap->arr[ind] = heap->arr[parent_ind];
+        heap->arr[parent_ind] = temp;
+
+        ind = parent_ind;
+    }
+
+    return(SP_OK);
+}
+
+int external_id(const Data* data, int vertex)
+{
+    // Translate an internal vertex id back to the id used in the graph file
+    if (data->new_to_old == NULL)
+    {
+        return(vertex);
+    }
+
+    return(data->new_to_old[vertex]);
+}
+
+static inline int external_state(const Data* data, int state, int layers)
+{
+    // State id under the graph file vertex ids (ties are broken on these, so that every vertex
+    // ordering picks the same path)
+    return(external_id(data, state / layers) * layers + state % layers);
+}
+
+int internal_id(const Data* data, int vertex)
+{
+    // Translate a graph file vertex id to the internal id (out of range ids are passed through)
+    if (data->old_to_new == NULL || vertex < 0 || vertex >= data->V)
+    {
+        return(vertex);
+    }
+
+    return(data->old_to_new[vertex]);
+}
+
+static inline const unsigned char* block_bytes(const AdjBlock* block)
+{
+    return((const unsigned char*)block->edges);
+}
+
+static inline int packed_weight(const AdjBlock* block, int i, int j)
+{
+    // Weight j of the i-th edge of a compressed block (column j, row i)
+    uint64_t bit = ((uint64_t)j * block->edge_num + i) * block->weight_bits;
+    uint64_t word;
+    memcpy(&word, block_bytes(block) + block->weight_offset + (bit >> 3), sizeof(word)); // Blocks are padded for this read
+    return(block->weight_base + (int)((word >> (bit & 7)) & block->weight_mask));
+}
+
+typedef struct
+{
+    const AdjBlock *block; // Block of the vertex
+    int i; // Next edge
+    int end; // One past the last edge of the vertex
+    int target; // Last decoded target (compressed)
+    const unsigned char *cursor; // Next target varint (compressed)
+} EdgeCursor;
+
+static inline __attribute__((always_inline)) void edges_begin_block(EdgeCursor* it, const AdjBlock* block, int u, const int packed)
+{
+    // Start walking the outgoing edges of u in its block; packed is a constant in the kernels
+    int k = u % ADJ_BLOCK;
+    it->block = block;
+    it->i = it->block->start[k];
+    it->end = it->block->start[k + 1];
+    if (packed)
+    {
+        it->target = u;
+        it->cursor = block_bytes(it->block) + it->block->target_start[k];
+    }
+}
+
+static inline __attribute__((always_inline)) void edges_begin(EdgeCursor* it, const Data* data, int u, const int packed)
+{
+    edges_begin_block(it, data->blocks[u / ADJ_BLOCK], u, packed);
+}
+
+static inline __attribute__((always_inline)) int edges_next(EdgeCursor* it, int weight_ind, int *v, int *weight, const int packed)
+{
+    // Next edge target and its weight_ind-th weight; returns 0 after the last edge
+    if (it->i == it->end)
+    {
+        return(0);
+    }
+
+    if (packed)
+    {
+        unsigned int zigzag = 0;
+        int shift = 0;
+        unsigned char byte;
+        do
+        {
+            byte = *(it->cursor)++;
+            zigzag |= (unsigned int)(byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+
+        it->target += (int)(zigzag >> 1) ^ -(int)(zigzag & 1);
+        *v = it->target;
+        *weight = packed_weight(it->block, it->i, weight_ind);
+    }
+    else
+    {
+        *v = it->block->edges[it->i].vt;
+        *weight = it->block->edges[it->i].weights[weight_ind];
+    }
+
+    (it->i)++;
+    return(1);
+}
+
+// Step layers tracked per vertex when the weight period is n. The step counter wraps at ADDON,
+// so a period that divides ADDON can wrap at n instead without changing any weight lookup.
+#define STEP_LAYERS(n) ((ADDON % (n) == 0) ? (n) : ADDON)
+
+static inline __attribute__((always_inline)) void search_kernel(int source, const Data* data, sp_query* query, const int n, const int layers, const int packed)
+{
+    // n, layers and packed are compile-time constants in every caller, so the step arithmetic and
+    // the state stride below fold into constants (no runtime division, unrollable loops)
+    int (*distance)[layers] = (int (*)[layers])query->distance; // 2D array of distances between vertices (cumulative weights)
+    int (*previous)[layers] = (int (*)[layers])query->previous; // Array to track the path
+    int (*hops)[layers] = (int (*)[layers])query->hops; // Edges on the path (equal distances prefer fewer)
+
+    for (int i = 0; i < data->V; i++)
+    {
+        for (int j = 0; j < layers; j++)
+        {
+            distance[i][j] = INF; // Initialize distances 2D array
+            previous[i][j] = -1; // Initialize previous array
+            hops[i][j] = 0;
+        }
+    }
+
+    distance[source][0] = 0; // Initialize source to have 0 distance
+
+    Heap* minheap = query->minheap;
+    minheap->curr_size = 0;
+
+    // Populate minheap
+    for (int i = 0; i < data->V; i++)
+    {
+        for (int j = 0; j < layers; j++)
+        {
+            Node node = {i * layers + j, distance[i][j], j, 0};
+            minheap->arr[i * layers + j] = node;
+            (minheap->curr_size)++;
+        }
+    }
+
+    // Initialize source vertex in minheap with a distance of 0 and step 0
+    decrease_key(minheap, source * layers, 0, 0, 0);
+
+    while (minheap->curr_size > 0)
+    {
+        // Get root (smallest value) of minheap
+        Node minNode = extract_min(minheap);
+        int u = minNode.vertex / layers;
+        int curr_step = minNode.step;
+        int weight_ind = curr_step % n; // Same for every outgoing edge
+        int next_step = (curr_step + 1) % layers;
+
+        if (distance[u][curr_step] == INF)
+        {
+            continue; // Unreachable state, nothing to relax
+        }
+
+        EdgeCursor edges;
+        int v;
+        int weight;
+        for (edges_begin(&edges, data, u, packed); edges_next(&edges, weight_ind, &v, &weight, packed); ) // Outgoing edges of u
+        {
+            // Labels are (distance, hops) in lexicographic order, so the tree does not depend on
+            // the order states leave the heap: equal labels go to the predecessor with the
+            // smallest graph file state id
+            int candidate = distance[u][curr_step] + weight;
+            int candidate_hops = hops[u][curr_step] + 1;
+            if (candidate < distance[v][next_step] || (candidate == distance[v][next_step] && candidate_hops < hops[v][next_step])) // Progress to next vertex
+            {
+                distance[v][next_step] = candidate; // Distance from source increases
+                hops[v][next_step] = candidate_hops;
+                previous[v][next_step] = u * layers + curr_step; // Path backtracking
+                decrease_key(minheap, v * layers + next_step, candidate, next_step, candidate_hops); // Update the distance and step of vertex in minheap with newly calculated shortest distance
+            }
+            else if (candidate == distance[v][next_step] && candidate_hops == hops[v][next_step] &&
+                     external_state(data, u * layers + curr_step, layers) < external_state(data, previous[v][next_step], layers))
+            {
+                previous[v][next_step] = u * layers + curr_step; // Same label, smaller predecessor
+            }
+        }
+    }
+}
+
+static inline __attribute__((always_inline)) void profile_kernel(int source, const Data* data, sp_query* query, const int n, const int layers, const int packed)
+{
+    // Shortest paths for every start phase 0 .. n - 1 in one label-correcting pass. Each state
+    // carries one (distance, hops) lane per start phase; the weight of an edge only depends on
+    // the state, so one relaxation updates all n lanes with the same add and min (vectorised).
+    // Labels and ties follow search_kernel, so every lane picks the path sp_query_path would.
+    int states = data->V * layers;
+    int (*distance)[n] = (int (*)[n])query->lane_distance; // distance[state][phase]
+    int (*previous)[n] = (int (*)[n])query->lane_previous; // previous[state][phase]
+    int (*hops)[n] = (int (*)[n])query->lane_hops; // hops[state][phase]
+    int *pending = query->pending; // Smallest lane improved since the state was last expanded (INF if none)
+    Heap* minheap = query->minheap;
+    minheap->curr_size = 0;
+
+    for (int i = 0; i < states; i++)
+    {
+        for (int p = 0; p < n; p++)
+        {
+            distance[i][p] = INF;
+            previous[i][p] = -1;
+            hops[i][p] = 0;
+        }
+        pending[i] = INF;
+    }
+
+    // Phase p starts at step p of the source
+    for (int p = 0; p < n; p++)
+    {
+        distance[source * layers + p][p] = 0;
+        pending[source * layers + p] = 0;
+        Node node = {source * layers + p, 0, p};
+        insert_node(minheap, node);
+    }
+
+    while (minheap->curr_size > 0)
+    {
+        Node minNode = extract_min(minheap);
+        int state = minNode.vertex;
+        int u = state / layers;
+        int curr_step = minNode.step;
+        int weight_ind = curr_step % n;
+        int next_step = (curr_step + 1) % layers;
+        pending[state] = INF;
+
+        EdgeCursor edges;
+        int v;
+        int weight;
+        for (edges_begin(&edges, data, u, packed); edges_next(&edges, weight_ind, &v, &weight, packed); ) // Outgoing edges of u
+        {
+            int next = v * layers + next_step;
+
+            // Relax every lane at once (branch-free so the loop vectorises)
+            int improved = INF;
+            int ties = 0;
+            for (int p = 0; p < n; p++)
+            {
+                int candidate = (distance[state][p] > INF - weight) ? INF : distance[state][p] + weight;
+                int candidate_hops = hops[state][p] + 1;
+                int better = candidate < distance[next][p] || (candidate == distance[next][p] && candidate_hops < hops[next][p]);
+                ties |= (candidate == distance[next][p] && candidate_hops == hops[next][p] && candidate != INF);
+                distance[next][p] = better ? candidate : distance[next][p];
+                hops[next][p] = better ? candidate_hops : hops[next][p];
+                previous[next][p] = better ? state : previous[next][p];
+                improved = (better && candidate < improved) ? candidate : improved;
+            }
+
+            for (int p = 0; p < n && ties; p++)
+            {
+                // Same label: the predecessor with the smallest graph file state id wins
+                if (distance[state][p] != INF && distance[state][p] + weight == distance[next][p] && hops[state][p] + 1 == hops[next][p] &&
+                    external_state(data, state, layers) < external_state(data, previous[next][p], layers))
+                {
+                    previous[next][p] = state;
+                }
+            }
+
+            if (improved < pending[next])
+            {
+                // Queue the state again, keyed by its smallest improved lane (a state is in the
+                // heap at most once, so the heap never outgrows its V * ADDON entries)
+                if (pending[next] == INF)
+                {
+                    Node node = {next, improved, next_step};
+                    insert_node(minheap, node);
+                }
+                else
+                {
+                    decrease_key(minheap, next, improved, next_step, 0);
+                }
+                pending[next] = improved;
+            }
+        }
+    }
+}
+
+static inline __attribute__((always_inline)) int range_kernel(int source, int budget, const Data* data, sp_query* query, int *vertices, int *distances, int *steps, int capacity, const int n, const int layers, const int packed)
+{
+    // Dijkstra from (source, step 0) that never queues a state beyond budget. Distances are only
+    // valid where the stamp says this query touched the state, so the work is proportional to
+    // the isochrone, not to the graph. Returns the number of reachable vertices.
+    int *distance = query->distance;
+    int *stamp = query->state_stamp;
+    int queued = 2 * query->generation;
+    int settled = queued + 1;
+    int count = 0;
+
+    Heap* minheap = query->minheap;
+    minheap->curr_size = 0;
+
+    distance[source * layers] = 0;
+    stamp[source * layers] = queued;
+    Node start = {source * layers, 0, 0};
+    insert_node(minheap, start);
+
+    while (minheap->curr_size > 0)
+    {
+        Node minNode = extract_min(minheap);
+        int state = minNode.vertex;
+        int u = state / layers;
+        int curr_step = minNode.step;
+        int weight_ind = curr_step % n;
+        int next_step = (curr_step + 1) % layers;
+        stamp[state] = settled;
+
+        // First settled state of u is its best distance over all steps
+        if (query->vertex_stamp[u] != query->generation)
+        {
+            query->vertex_stamp[u] = query->generation;
+            if (count < capacity)
+            {
+                vertices[count] = external_id(data, u);
+                distances[count] = minNode.distance;
+                steps[count] = weight_ind; // Phase modulo N for every N, not the internal layer
+            }
+            count++;
+        }
+
+        EdgeCursor edges;
+        int v;
+        int weight;
+        for (edges_begin(&edges, data, u, packed); edges_next(&edges, weight_ind, &v, &weight, packed); ) // Outgoing edges of u
+        {
+            int next = v * layers + next_step;
+            if (weight > budget - minNode.distance || stamp[next] == settled)
+            {
+                continue; // Over budget or already final
+            }
+
+            int candidate = minNode.distance + weight;
+            if (stamp[next] != queued) // Queued at most once, so the heap never has to grow
+            {
+                distance[next] = candidate;
+                stamp[next] = queued;
+                Node node = {next, candidate, next_step};
+                insert_node(minheap, node);
+            }
+            else if (candidate < distance[next])
+            {
+                distance[next] = candidate;
+                decrease_key(minheap, next, candidate, next_step, 0);
+            }
+        }
+    }
+
+    return(count);
+}
+
+// One specialised search, profile and range kernel per weight period and block format
+#define DEFINE_KERNEL_SET(suffix, n, packed) \
+    void search_##suffix(int source, const Data* data, sp_query* query) \
+    { \
+        search_kernel(source, data, query, n, STEP_LAYERS(n), packed); \
+    } \
+    void profile_##suffix(int source, const Data* data, sp_query* query) \
+    { \
+        profile_kernel(source, data, query, n, STEP_LAYERS(n), packed); \
+    } \
+    int range_##suffix(int source, int budget, const Data* data, sp_query* query, int *vertices, int *distances, int *steps, int capacity) \
+    { \
+        return(range_kernel(source, budget, data, query, vertices, distances, steps, capacity, n, STEP_LAYERS(n), packed)); \
+    }
+
+#define DEFINE_SEARCH_KERNEL(period) \
+    DEFINE_KERNEL_SET(n##period, period, 0) \
+    DEFINE_KERNEL_SET(packed_n##period, period, 1)
+
+DEFINE_SEARCH_KERNEL(1)
+DEFINE_SEARCH_KERNEL(2)
+DEFINE_SEARCH_KERNEL(3)
+DEFINE_SEARCH_KERNEL(4)
+DEFINE_SEARCH_KERNEL(5)
+DEFINE_SEARCH_KERNEL(6)
+DEFINE_SEARCH_KERNEL(7)
+DEFINE_SEARCH_KERNEL(8)
+DEFINE_SEARCH_KERNEL(9)
+DEFINE_SEARCH_KERNEL(10)
+
+int select_kernels(Data* data)
+{
+    // Picked once at load time
+    static const SearchFn search_kernels[2][MAX_WEIGHTS + 1] = {
+        {NULL, search_n1, search_n2, search_n3, search_n4, search_n5,
+         search_n6, search_n7, search_n8, search_n9, search_n10},
+        {NULL, search_packed_n1, search_packed_n2, search_packed_n3, search_packed_n4, search_packed_n5,
+         search_packed_n6, search_packed_n7, search_packed_n8, search_packed_n9, search_packed_n10}
+    };
+    static const ProfileFn profile_kernels[2][MAX_WEIGHTS + 1] = {
+        {NULL, profile_n1, profile_n2, profile_n3, profile_n4, profile_n5,
+         profile_n6, profile_n7, profile_n8, profile_n9, profile_n10},
+        {NULL, profile_packed_n1, profile_packed_n2, profile_packed_n3, profile_packed_n4, profile_packed_n5,
+         profile_packed_n6, profile_packed_n7, profile_packed_n8, profile_packed_n9, profile_packed_n10}
+    };
+    static const RangeFn range_kernels[2][MAX_WEIGHTS + 1] = {
+        {NULL, range_n1, range_n2, range_n3, range_n4, range_n5,
+         range_n6, range_n7, range_n8, range_n9, range_n10},
+        {NULL, range_packed_n1, range_packed_n2, range_packed_n3, range_packed_n4, range_packed_n5,
+         range_packed_n6, range_packed_n7, range_packed_n8, range_packed_n9, range_packed_n10}
+    };
+
+    if (data->N < 1 || data->N > MAX_WEIGHTS)
+    {
+        return(SP_ERR_FORMAT); // Unsupported number of edge weights
+    }
+
+    data->search = search_kernels[data->packed][data->N];
+    data->profile = profile_kernels[data->packed][data->N];
+    data->range = range_kernels[data->packed][data->N];
+    return(SP_OK);
+}
+
+void dijkstra(int source, const Data* data, sp_query* query)
+{
+    // Distances from source (step 0) to every state, left in query->distance / query->previous
+    data->search(source, data, query);
+}
+
+void profile(int source, const Data* data, sp_query* query)
+{
+    // Distances from source for each start phase 0 .. N - 1, left in the query's lanes
+    data->profile(source, data, query);
+}
+
+int best_step(const int *distance, int stride, int lane, int vertex, int layers)
+{
+    // Step with the minimum distance at vertex (-1 if unreachable); distance[state * stride + lane]
+    int min_dist = INF;
+    int min_step = -1;
+    for (int step = 0; step < layers; step++)
+    {
+        if (distance[(vertex * layers + step) * stride + lane] < min_dist)
+        {
+            min_dist = distance[(vertex * layers + step) * stride + lane];
+            min_step = step;
+        }
+    }
+
+    return(min_step);
+}
+
+int write_path(const Data* data, const int *previous, int stride, int lane, int state, int *path, int capacity)
+{
+    // Backtrack from state; path gets the graph file ids (source first) if it has room.
+    // Returns the number of vertices on the path.
+    int layers = STEP_LAYERS(data->N);
+    int length = 0;
+    for (int current_node = state; current_node != -1; current_node = previous[current_node * stride + lane])
+    {
+        length++;
+    }
+
+    if (length <= capacity)
+    {
+        int path_index = length;
+        for (int current_node = state; current_node != -1; current_node = previous[current_node * stride + lane])
+        {
+            path[--path_index] = external_id(data, current_node / layers);
+        }
+    }
+
+    return(length);
+}
+
+AdjBlock* alloc_bytes_block(int edge_num, int bytes)
+{
+    // NULL if out of memory
+    AdjBlock* block = (AdjBlock*)malloc(sizeof(AdjBlock) + bytes);
+    if (block == NULL)
+    {
+        return(NULL);
+    }
+
+    atomic_init(&block->refs, 1);
+    block->edge_num = edge_num;
+    block->bytes = bytes;
+    return(block);
+}
+
+AdjBlock* alloc_block(int edge_num)
+{
+    return(alloc_bytes_block(edge_num, (edge_num + 1) * sizeof(Edge)));
+}
+
+int varint_size(unsigned int value)
+{
+    int size = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        size++;
+    }
+    return(size);
+}
+
+unsigned int zigzag(int delta)
+{
+    return(((unsigned int)delta << 1) ^ (unsigned int)(delta >> 31));
+}
+
+AdjBlock* pack_block(const AdjBlock* plain, int first_vertex, int N)
+{
+    // Compressed copy of a plain block whose first vertex is first_vertex
+    int min_weight = INT_MAX;
+    int max_weight = INT_MIN;
+    int target_bytes = 0;
+    for (int k = 0; k < ADJ_BLOCK; k++)
+    {
+        int previous = first_vertex + k;
+        for (int i = plain->start[k]; i < plain->start[k + 1]; i++)
+        {
+            target_bytes += varint_size(zigzag(plain->edges[i].vt - previous));
+            previous = plain->edges[i].vt;
+            for (int j = 0; j < N; j++)
+            {
+                min_weight = (plain->edges[i].weights[j] < min_weight) ? plain->edges[i].weights[j] : min_weight;
+                max_weight = (plain->edges[i].weights[j] > max_weight) ? plain->edges[i].weights[j] : max_weight;
+            }
+        }
+    }
+
+    int bits = 0;
+    if (plain->edge_num > 0)
+    {
+        while (bits < 32 && ((uint64_t)max_weight - (uint64_t)min_weight) >> bits != 0)
+        {
+            bits++; // Smallest width that fits the weight range
+        }
+    }
+
+    uint64_t weight_bits = (uint64_t)plain->edge_num * N * bits;
+    int weight_bytes = (int)((weight_bits + 7) / 8) + sizeof(uint64_t); // Padding for the 64-bit reads in packed_weight
+    AdjBlock* block = alloc_bytes_block(plain->edge_num, target_bytes + weight_bytes);
+    if (block == NULL)
+    {
+        return(NULL);
+    }
+
+    unsigned char *bytes = (unsigned char*)block->edges;
+    memcpy(block->start, plain->start, sizeof(block->start));
+    memset(bytes, 0, block->bytes);
+    block->weight_offset = target_bytes;
+    block->weight_base = (plain->edge_num > 0) ? min_weight : 0;
+    block->weight_bits = bits;
+    block->weight_mask = (bits == 0) ? 0 : (((uint64_t)1 << bits) - 1);
+
+    int offset = 0;
+    for (int k = 0; k <= ADJ_BLOCK; k++)
+    {
+        block->target_start[k] = offset;
+        if (k == ADJ_BLOCK)
+        {
+            break;
+        }
+
+        int previous = first_vertex + k;
+        for (int i = plain->start[k]; i < plain->start[k + 1]; i++)
+        {
+            unsigned int value = zigzag(plain->edges[i].vt - previous);
+            previous = plain->edges[i].vt;
+            while (value >= 0x80)
+            {
+                bytes[offset++] = (unsigned char)(value | 0x80);
+                value >>= 7;
+            }
+            bytes[offset++] = (unsigned char)value;
+        }
+    }
+
+    for (int j = 0; j < N; j++)
+    {
+        for (int i = 0; i < plain->edge_num; i++)
+        {
+            uint64_t bit = ((uint64_t)j * plain->edge_num + i) * bits;
+            uint64_t value = (uint64_t)plain->edges[i].weights[j] - (uint64_t)block->weight_base;
+            for (int b = 0; b < bits; b++) // Bit by bit, packing only happens at load and on updates
+            {
+                if ((value >> b) & 1)
+                {
+                    bytes[target_bytes + ((bit + b) >> 3)] |= (unsigned char)(1 << ((bit + b) & 7));
+                }
+            }
+        }
+    }
+
+    return(block);
+}
+
+AdjBlock* unpack_block(const AdjBlock* block, int first_vertex, int N)
+{
+    // Plain copy of a compressed block (used to apply updates)
+    AdjBlock* plain = alloc_block(block->edge_num);
+    if (plain == NULL)
+    {
+        return(NULL);
+    }
+
+    memcpy(plain->start, block->start, sizeof(plain->start));
+    for (int k = 0; k < ADJ_BLOCK; k++)
+    {
+        EdgeCursor it;
+        it.block = block;
+        it.i = block->start[k];
+        it.end = block->start[k + 1];
+        it.target = first_vertex + k;
+        it.cursor = block_bytes(block) + block->target_start[k];
+
+        int v;
+        int weight;
+        for (int i = it.i; edges_next(&it, 0, &v, &weight, 1); i++)
+        {
+            plain->edges[i].vs = first_vertex + k;
+            plain->edges[i].vt = v;
+            for (int j = 0; j < MAX_WEIGHTS; j++)
+            {
+                plain->edges[i].weights[j] = (j < N) ? packed_weight(block, i, j) : 0;
+            }
+        }
+    }
+
+    return(plain);
+}
+
+void free_blocks(AdjBlock **blocks, int num_blocks)
+{
+    // Blocks of a version that was never published
+    for (int b = 0; b < num_blocks; b++)
+    {
+        free(blocks[b]);
+    }
+    free(blocks);
+}
+
+int build_adjacency(Data* data)
+{
+    // Group edges by source vertex (stable counting sort, so each vertex keeps its graph file edge order).
+    // Plain blocks only: compressed loads go through build_packed_adjacency.
+    int *count = (int*)calloc(data->V + 1, sizeof(int));
+    int *adj_start = (int*)malloc((data->V + 1) * sizeof(int));
+    Edge *sorted = (Edge*)malloc((data->edge_num + 1) * sizeof(Edge));
+    data->num_blocks = (data->V + ADJ_BLOCK - 1) / ADJ_BLOCK;
+    data->blocks = (AdjBlock**)calloc(data->num_blocks + 1, sizeof(AdjBlock*));
+    if (count == NULL || adj_start == NULL || sorted == NULL || data->blocks == NULL)
+    {
+        free(count);
+        free(adj_start);
+        free(sorted);
+        free(data->blocks);
+        data->blocks = NULL;
+        return(SP_ERR_MEMORY);
+    }
+
+    for (int i = 0; i < data->edge_num; i++)
+    {
+        count[data->edges[i].vs + 1]++;
+    }
+
+    for (int u = 0; u < data->V; u++)
+    {
+        count[u + 1] += count[u]; // Prefix sums give the first edge of each vertex
+    }
+
+    for (int u = 0; u <= data->V; u++)
+    {
+        adj_start[u] = count[u];
+    }
+
+    for (int i = 0; i < data->edge_num; i++)
+    {
+        sorted[count[data->edges[i].vs]++] = data->edges[i];
+    }
+
+    // Cut the grouped edges into blocks of ADJ_BLOCK vertices
+    int status = SP_OK;
+    for (int b = 0; b < data->num_blocks; b++)
+    {
+        int first = b * ADJ_BLOCK;
+        int last = (first + ADJ_BLOCK < data->V) ? first + ADJ_BLOCK : data->V;
+        AdjBlock* block = alloc_block(adj_start[last] - adj_start[first]);
+        if (block == NULL)
+        {
+            status = SP_ERR_MEMORY;
+            break;
+        }
+
+        for (int k = 0; k <= ADJ_BLOCK; k++)
+        {
+            int u = (first + k < last) ? first + k : last;
+            block->start[k] = adj_start[u] - adj_start[first];
+        }
+
+        memcpy(block->edges, sorted + adj_start[first], block->edge_num * sizeof(Edge));
+        data->blocks[b] = block;
+    }
+
+    free(sorted);
+    free(adj_start);
+    free(count);
+    if (status != SP_OK)
+    {
+        free_blocks(data->blocks, data->num_blocks);
+        data->blocks = NULL;
+    }
+    return(status);
+}
+
+int compare_keys(const void *a, const void *b)
+{
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+    return((x > y) - (x < y));
+}
+
+int sort_by_degree(int *vertices, int count, const int *degree, int descending)
+{
+    // Sort vertex ids by degree, ties by id (keys instead of a global for the comparator, so loads are reentrant)
+    long long *keys = (long long*)malloc((count + 1) * sizeof(long long));
+    if (keys == NULL)
+    {
+        return(SP_ERR_MEMORY);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        long long d = descending ? -(long long)degree[vertices[i]] : degree[vertices[i]];
+        keys[i] = d * (1LL << 32) + vertices[i];
+    }
+
+    qsort(keys, count, sizeof(long long), compare_keys);
+    for (int i = 0; i < count; i++)
+    {
+        vertices[i] = (int)(keys[i] - (keys[i] >> 32) * (1LL << 32));
+    }
+
+    free(keys);
+    return(SP_OK);
+}
+
+int breadth_first_order(int V, const int *nbr_start, const int *nbr, const int *starts, int *order)
+{
+    // BFS over every component, trying start vertices in the given order
+    int *seen = (int*)calloc(V, sizeof(int));
+    if (seen == NULL)
+    {
+        return(SP_ERR_MEMORY);
+    }
+
+    int head = 0;
+    int tail = 0;
+
+    for (int i = 0; i < V; i++)
+    {
+        if (seen[starts[i]])
+        {
+            continue;
+        }
+
+        seen[starts[i]] = 1;
+        order[tail++] = starts[i];
+        while (head < tail)
+        {
+            int u = order[head++];
+            for (int j = nbr_start[u]; j < nbr_start[u + 1]; j++)
+            {
+                if (!seen[nbr[j]])
+                {
+                    seen[nbr[j]] = 1;
+                    order[tail++] = nbr[j];
+                }
+            }
+        }
+    }
+
+    free(seen);
+    return(SP_OK);
+}
+
+int vertex_order(int V, const int *degree, const int *nbr_start, int *nbr, int order, int *new_to_old)
+{
+    // new_to_old for an SP_ORDER_* other than NONE, from undirected neighbour lists
+    int *starts = (int*)malloc((V + 1) * sizeof(int));
+    if (starts == NULL)
+    {
+        return(SP_ERR_MEMORY);
+    }
+
+    for (int u = 0; u < V; u++)
+    {
+        starts[u] = u;
+    }
+
+    int status = SP_OK;
+    if (order == SP_ORDER_BFS)
+    {
+        status = breadth_first_order(V, nbr_start, nbr, starts, new_to_old);
+    }
+    else if (order == SP_ORDER_RCM)
+    {
+        // Cuthill-McKee: start each component at a low degree vertex and visit neighbours by increasing degree
+        status = sort_by_degree(starts, V, degree, 0);
+        for (int u = 0; u < V && status == SP_OK; u++)
+        {
+            status = sort_by_degree(nbr + nbr_start[u], nbr_start[u + 1] - nbr_start[u], degree, 0);
+        }
+        if (status == SP_OK)
+        {
+            status = breadth_first_order(V, nbr_start, nbr, starts, new_to_old);
+        }
+
+        // Reverse it
+        for (int i = 0; i < V / 2; i++)
+        {
+            int temp = new_to_old[i];
+            new_to_old[i] = new_to_old[V - 1 - i];
+            new_to_old[V - 1 - i] = temp;
+        }
+    }
+    else // SP_ORDER_DEGREE
+    {
+        status = sort_by_degree(starts, V, degree, 1);
+        for (int i = 0; i < V; i++)
+        {
+            new_to_old[i] = starts[i];
+        }
+    }
+
+    free(starts);
+    return(status);
+}
+
+int reorder_vertices(Data* data, int order)
+{
+    // Relabel vertices so that vertices searched together sit close together in memory
+    if (order == SP_ORDER_NONE)
+    {
+        return(SP_OK);
+    }
+
+    int V = data->V;
+    int *degree = (int*)calloc(V, sizeof(int));
+    int *nbr_start = (int*)calloc(V + 1, sizeof(int));
+    int *nbr = (int*)malloc((2 * (size_t)data->edge_num + 1) * sizeof(int));
+    int *fill = (int*)malloc((V + 1) * sizeof(int));
+    int *new_to_old = (int*)malloc(V * sizeof(int));
+    int *old_to_new = (int*)malloc(V * sizeof(int));
+    int status = SP_ERR_MEMORY;
+    if (degree != NULL && nbr_start != NULL && nbr != NULL && fill != NULL && new_to_old != NULL && old_to_new != NULL)
+    {
+        // Undirected neighbour lists (locality matters in both edge directions)
+        for (int i = 0; i < data->edge_num; i++)
+        {
+            degree[data->edges[i].vs]++;
+            degree[data->edges[i].vt]++;
+        }
+
+        for (int u = 0; u < V; u++)
+        {
+            nbr_start[u + 1] = nbr_start[u] + degree[u];
+        }
+
+        memcpy(fill, nbr_start, (V + 1) * sizeof(int));
+        for (int i = 0; i < data->edge_num; i++)
+        {
+            nbr[fill[data->edges[i].vs]++] = data->edges[i].vt;
+            nbr[fill[data->edges[i].vt]++] = data->edges[i].vs;
+        }
+
+        status = vertex_order(V, degree, nbr_start, nbr, order, new_to_old);
+    }
+
+    free(degree);
+    free(nbr_start);
+    free(nbr);
+    free(fill);
+    if (status != SP_OK)
+    {
+        free(new_to_old);
+        free(old_to_new);
+        return(status);
+    }
+
+    for (int i = 0; i < V; i++)
+    {
+        old_to_new[new_to_old[i]] = i;
+    }
+
+    // Relabel edges (build_adjacency regroups them under the new source ids)
+    for (int i = 0; i < data->edge_num; i++)
+    {
+        data->edges[i].vs = old_to_new[data->edges[i].vs];
+        data->edges[i].vt = old_to_new[data->edges[i].vt];
+    }
+
+    data->old_to_new = old_to_new;
+    data->new_to_old = new_to_old;
+    return(SP_OK);
+}
+
+int next_int(const char **cursor, const char *end, int *value)
+{
+    // Read one decimal integer, skipping whitespace; returns 0 at the end of the text or on a non-number
+    const char *c = *cursor;
+    while (c < end && isspace((unsigned char)*c))
+    {
+        c++;
+    }
+
+    int negative = 0;
+    if (c < end && (*c == '-' || *c == '+'))
+    {
+        negative = (*c == '-');
+        c++;
+    }
+
+    if (c == end || !isdigit((unsigned char)*c))
+    {
+        *cursor = c;
+        return(0);
+    }
+
+    long number = 0;
+    while (c < end && isdigit((unsigned char)*c))
+    {
+        number = number * 10 + (*c - '0');
+        c++;
+    }
+
+    *value = (int)(negative ? -number : number);
+    *cursor = c;
+    return(1);
+}
+
+int read_edge(const char **cursor, const char *end, int V, int N, Edge* edge)
+{
+    // Next edge of the graph text: 1 if read, 0 at the end, SP_ERR_FORMAT for a vertex out of range.
+    // Missing weights are 0.
+    if (!next_int(cursor, end, &edge->vs) || !next_int(cursor, end, &edge->vt))
+    {
+        return(0);
+    }
+
+    if (edge->vs < 0 || edge->vs >= V || edge->vt < 0 || edge->vt >= V)
+    {
+        return(SP_ERR_FORMAT);
+    }
+
+    for (int j = 0; j < MAX_WEIGHTS; j++)
+    {
+        if (j >= N || !next_int(cursor, end, &edge->weights[j]))
+        {
+            edge->weights[j] = 0;
+        }
+    }
+    return(1);
+}
+
+typedef struct
+{
+    unsigned char *bytes; // Edges of one block in graph file order, as varints: k, zigzag(vt - vs), N zigzag weights
+    size_t used; // Bytes written
+    size_t capacity; // Bytes allocated
+} EdgeStage;
+
+void put_varint(unsigned char *bytes, size_t *used, unsigned int value)
+{
+    while (value >= 0x80)
+    {
+        bytes[(*used)++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    bytes[(*used)++] = (unsigned char)value;
+}
+
+unsigned int get_varint(const unsigned char **cursor)
+{
+    unsigned int value = 0;
+    int shift = 0;
+    unsigned char byte;
+    do
+    {
+        byte = *(*cursor)++;
+        value |= (unsigned int)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return(value);
+}
+
+int unzigzag(unsigned int value)
+{
+    return((int)(value >> 1) ^ -(int)(value & 1));
+}
+
+int stage_edge(EdgeStage* stage, const Edge* edge, int N)
+{
+    // Append an edge (already relabeled) to the stage of its block
+    size_t worst = (size_t)(N + 2) * 5;
+    if (stage->used + worst > stage->capacity)
+    {
+        size_t capacity = (stage->capacity < 256) ? 256 : 2 * stage->capacity;
+        unsigned char *grown = (unsigned char*)realloc(stage->bytes, capacity);
+        if (grown == NULL)
+        {
+            return(SP_ERR_MEMORY);
+        }
+        stage->bytes = grown;
+        stage->capacity = capacity;
+    }
+
+    put_varint(stage->bytes, &stage->used, edge->vs % ADJ_BLOCK);
+    put_varint(stage->bytes, &stage->used, zigzag(edge->vt - edge->vs));
+    for (int j = 0; j < N; j++)
+    {
+        put_varint(stage->bytes, &stage->used, zigzag(edge->weights[j]));
+    }
+    return(SP_OK);
+}
+
+int text_vertex_order(Data* data, const char *text, const char *end, const int *degree, int order)
+{
+    // reorder_vertices for a graph that is still text: only BFS / RCM need the neighbour lists
+    int V = data->V;
+    int *nbr_start = NULL;
+    int *nbr = NULL;
+    int *new_to_old = (int*)malloc(V * sizeof(int));
+    int *old_to_new = (int*)malloc(V * sizeof(int));
+    int status = (new_to_old != NULL && old_to_new != NULL) ? SP_OK : SP_ERR_MEMORY;
+    if (status == SP_OK && order != SP_ORDER_DEGREE)
+    {
+        nbr_start = (int*)calloc(V + 1, sizeof(int));
+        nbr = (int*)malloc((2 * (size_t)data->edge_num + 1) * sizeof(int));
+        if (nbr_start == NULL || nbr == NULL)
+        {
+            status = SP_ERR_MEMORY;
+        }
+        else
+        {
+            for (int u = 0; u < V; u++)
+            {
+                nbr_start[u + 1] = nbr_start[u] + degree[u];
+            }
+
+            memcpy(old_to_new, nbr_start, V * sizeof(int)); // Fill positions until the relabeling
+            const char *cursor = text;
+            Edge edge;
+            while (read_edge(&cursor, end, V, data->N, &edge) > 0)
+            {
+                nbr[old_to_new[edge.vs]++] = edge.vt;
+                nbr[old_to_new[edge.vt]++] = edge.vs;
+            }
+        }
+    }
+
+    if (status == SP_OK)
+    {
+        status = vertex_order(V, degree, nbr_start, nbr, order, new_to_old);
+    }
+
+    free(nbr_start);
+    free(nbr);
+    if (status != SP_OK)
+    {
+        free(new_to_old);
+        free(old_to_new);
+        return(status);
+    }
+
+    for (int i = 0; i < V; i++)
+    {
+        old_to_new[new_to_old[i]] = i;
+    }
+
+    data->old_to_new = old_to_new;
+    data->new_to_old = new_to_old;
+    return(SP_OK);
+}
+
+int build_packed_adjacency(Data* data, const char *text, const char *end, int order)
+{
+    // SP_COMPRESS load straight from the text, without an Edge array: count the edges, stage each
+    // block's edges as varints, then turn the stages into compressed blocks one at a time. Memory is
+    // O(V) plus the staged and packed bytes (and 8 bytes per edge while computing a BFS / RCM order).
+    int V = data->V;
+    int N = data->N;
+    data->num_blocks = (V + ADJ_BLOCK - 1) / ADJ_BLOCK;
+    data->blocks = (AdjBlock**)calloc(data->num_blocks + 1, sizeof(AdjBlock*));
+    EdgeStage *stage = (EdgeStage*)calloc(data->num_blocks + 1, sizeof(EdgeStage));
+    int *out_degree = (int*)calloc(V, sizeof(int));
+    int *degree = (int*)calloc(V, sizeof(int));
+    int status = (data->blocks != NULL && stage != NULL && out_degree != NULL && degree != NULL) ? SP_OK : SP_ERR_MEMORY;
+
+    // Pass 1: validate and count
+    const char *cursor = text;
+    Edge edge;
+    int got;
+    data->edge_num = 0;
+    while (status == SP_OK && (got = read_edge(&cursor, end, V, N, &edge)) != 0)
+    {
+        if (got < 0)
+        {
+            status = got;
+            break;
+        }
+        out_degree[edge.vs]++;
+        degree[edge.vs]++;
+        degree[edge.vt]++;
+        data->edge_num++;
+    }
+
+    if (status == SP_OK && order != SP_ORDER_NONE)
+    {
+        status = text_vertex_order(data, text, end, degree, order); // Optional relabeling for cache locality
+    }
+
+    // Pass 2: stage every edge under its (relabeled) source block, keeping the graph file order
+    cursor = text;
+    while (status == SP_OK && read_edge(&cursor, end, V, N, &edge) > 0)
+    {
+        if (data->old_to_new != NULL)
+        {
+            edge.vs = data->old_to_new[edge.vs];
+            edge.vt = data->old_to_new[edge.vt];
+        }
+        status = stage_edge(&stage[edge.vs / ADJ_BLOCK], &edge, N);
+    }
+
+    // Group each stage by source vertex (stable, like build_adjacency) and compress it
+    for (int b = 0; b < data->num_blocks && status == SP_OK; b++)
+    {
+        int first = b * ADJ_BLOCK;
+        int last = (first + ADJ_BLOCK < V) ? first + ADJ_BLOCK : V;
+        int fill[ADJ_BLOCK + 1];
+        fill[0] = 0;
+        for (int k = 0; k < ADJ_BLOCK; k++)
+        {
+            int u = first + k;
+            fill[k + 1] = fill[k] + ((u < last) ? out_degree[(data->new_to_old != NULL) ? data->new_to_old[u] : u] : 0);
+        }
+
+        AdjBlock* plain = alloc_block(fill[ADJ_BLOCK]);
+        if (plain == NULL)
+        {
+            status = SP_ERR_MEMORY;
+            break;
+        }
+        memcpy(plain->start, fill, sizeof(plain->start));
+
+        const unsigned char *c = stage[b].bytes;
+        const unsigned char *stage_end = c + stage[b].used;
+        while (c < stage_end)
+        {
+            int k = (int)get_varint(&c);
+            Edge *e = &plain->edges[fill[k]++];
+            e->vs = first + k;
+            e->vt = e->vs + unzigzag(get_varint(&c));
+            for (int j = 0; j < MAX_WEIGHTS; j++)
+            {
+                e->weights[j] = (j < N) ? unzigzag(get_varint(&c)) : 0;
+            }
+        }
+        free(stage[b].bytes);
+        stage[b].bytes = NULL;
+
+        data->blocks[b] = pack_block(plain, first, N);
+        free(plain);
+        if (data->blocks[b] == NULL)
+        {
+            status = SP_ERR_MEMORY;
+        }
+    }
+
+    if (stage != NULL)
+    {
+        for (int b = 0; b < data->num_blocks; b++)
+        {
+            free(stage[b].bytes);
+        }
+    }
+    free(stage);
+    free(out_degree);
+    free(degree);
+    if (status != SP_OK && data->blocks != NULL)
+    {
+        free_blocks(data->blocks, data->num_blocks);
+        data->blocks = NULL;
+    }
+    return(status);
+}
+
+Data* read_data(const char *text, size_t length, int options, int *status)
+{
+    // Parse a graph from memory (see sp_graph_load_buffer for the format)
+    const char *cursor = text;
+    const char *end = text + length;
+
+    Data* data = (Data*)calloc(1, sizeof(Data));
+    if (data == NULL)
+    {
+        *status = SP_ERR_MEMORY;
+        return(NULL);
+    }
+
+    data->packed = (options & SP_COMPRESS) != 0;
+
+    // Read V (num of vertices) and N (num of weights)
+    if (!next_int(&cursor, end, &data->V) || !next_int(&cursor, end, &data->N) || data->V <= 0 || select_kernels(data) != SP_OK)
+    {
+        free(data);
+        *status = SP_ERR_FORMAT;
+        return(NULL);
+    }
+
+    int result;
+    if (data->packed)
+    {
+        result = build_packed_adjacency(data, cursor, end, options & SP_ORDER_MASK);
+    }
+    else
+    {
+        int capacity = MAX_LINES;
+        data->edges = (Edge*)malloc(capacity * sizeof(Edge));
+        result = (data->edges != NULL) ? SP_OK : SP_ERR_MEMORY;
+        data->edge_num = 0;
+        int got;
+        while (result == SP_OK && (got = read_edge(&cursor, end, data->V, data->N, &data->edges[data->edge_num])) != 0)
+        {
+            if (got < 0)
+            {
+                result = got;
+                break;
+            }
+
+            data->edge_num++;
+            if (data->edge_num == capacity) // Grow the edge array
+            {
+                capacity *= 2;
+                Edge *grown = (Edge*)realloc(data->edges, capacity * sizeof(Edge));
+                if (grown == NULL)
+                {
+                    result = SP_ERR_MEMORY;
+                    break;
+                }
+                data->edges = grown;
+            }
+        }
+
+        if (result == SP_OK)
+        {
+            result = reorder_vertices(data, options & SP_ORDER_MASK); // Optional relabeling for cache locality
+        }
+        if (result == SP_OK)
+        {
+            result = build_adjacency(data);
+        }
+        free(data->edges);
+        data->edges = NULL;
+    }
+
+    if (result != SP_OK)
+    {
+        free(data->old_to_new);
+        free(data->new_to_old);
+        free(data);
+        *status = result;
+        return(NULL);
+    }
+
+    atomic_init(&data->refs, 1);
+    data->version = 0;
+
+    *status = SP_OK;
+    return(data);
+}
+
+void graph_store_init(GraphStore* store, Data* data)
+{
+    // The store takes over the reference returned by read_data
+    atomic_init(&store->current, data);
+    atomic_init(&store->epoch, 0);
+    atomic_init(&store->readers[0], 0);
+    atomic_init(&store->readers[1], 0);
+    pthread_mutex_init(&store->write_lock, NULL);
+}
+
+void graph_release(Data* data);
+
+void graph_store_destroy(GraphStore* store)
+{
+    // No readers may be left; the vertex relabeling is shared by every version
+    Data* data = atomic_load(&store->current);
+    free(data->old_to_new);
+    free(data->new_to_old);
+    graph_release(data);
+    pthread_mutex_destroy(&store->write_lock);
+}
+
+Data* graph_acquire(GraphStore* store)
+{
+    // Take a reference to the latest version. Never waits for writers: a reader only retries
+    // if a writer flipped the epoch between the two loads below.
+    while (1)
+    {
+        int epoch = atomic_load(&store->epoch);
+        atomic_fetch_add(&store->readers[epoch], 1);
+        if (atomic_load(&store->epoch) == epoch)
+        {
+            Data* data = atomic_load(&store->current);
+            atomic_fetch_add(&data->refs, 1);
+            atomic_fetch_sub(&store->readers[epoch], 1);
+            return(data);
+        }
+        atomic_fetch_sub(&store->readers[epoch], 1);
+    }
+}
+
+void release_block(AdjBlock* block)
+{
+    if (atomic_fetch_sub(&block->refs, 1) == 1)
+    {
+        free(block);
+    }
+}
+
+void graph_release(Data* data)
+{
+    // Drop a reference; the last one frees the version and its unshared blocks
+    if (atomic_fetch_sub(&data->refs, 1) == 1)
+    {
+        for (int b = 0; b < data->num_blocks; b++)
+        {
+            release_block(data->blocks[b]);
+        }
+        free(data->blocks);
+        free(data);
+    }
+}
+
+Data* clone_version(const Data* data, int changed_block, AdjBlock* block)
+{
+    // New version sharing every block of data except changed_block, which becomes block
+    Data* copy = (Data*)malloc(sizeof(Data));
+    AdjBlock** blocks = (AdjBlock**)malloc((data->num_blocks + 1) * sizeof(AdjBlock*));
+    if (copy == NULL || blocks == NULL)
+    {
+        free(copy);
+        free(blocks);
+        return(NULL); // Out of memory
+    }
+
+    memcpy(copy, data, sizeof(Data));
+    for (int b = 0; b < data->num_blocks; b++)
+    {
+        if (b == changed_block)
+        {
+            blocks[b] = block;
+        }
+        else
+        {
+            blocks[b] = data->blocks[b];
+            atomic_fetch_add(&blocks[b]->refs, 1);
+        }
+    }
+
+    copy->blocks = blocks;
+    atomic_init(&copy->refs, 1);
+    copy->version = data->version + 1;
+    return(copy);
+}
+
+void publish_version(GraphStore* store, Data* data)
+{
+    // RCU-style swap, called with write_lock held. Readers that loaded the old pointer are
+    // counted in readers[old epoch]; once that drains they all hold their own reference.
+    Data* old = atomic_exchange(&store->current, data);
+    int epoch = atomic_load(&store->epoch);
+    atomic_store(&store->epoch, 1 - epoch);
+    while (atomic_load(&store->readers[epoch]) != 0)
+    {
+        sched_yield();
+    }
+
+    graph_release(old); // Drop the store's reference
+}
+
+AdjBlock* repack_block(const Data* data, int b, AdjBlock* block, AdjBlock* unpacked)
+{
+    // Updates edit plain blocks; compress the result again if the graph is compressed
+    if (!data->packed)
+    {
+        return(block);
+    }
+
+    AdjBlock* packed = pack_block(block, b * ADJ_BLOCK, data->N); // NULL if out of memory
+    free(block);
+    free(unpacked);
+    return(packed);
+}
+
+int graph_set_edge(GraphStore* store, int vs, int vt, const int *weights)
+{
+    // Overwrite the weights of edge vs -> vt (graph file ids), adding the edge if it is missing
+    pthread_mutex_lock(&store->write_lock);
+    Data* data = atomic_load(&store->current);
+    if (vs < 0 || vs >= data->V || vt < 0 || vt >= data->V)
+    {
+        pthread_mutex_unlock(&store->write_lock);
+        return(SP_ERR_RANGE);
+    }
+
+    int u = internal_id(data, vs);
+    int v = internal_id(data, vt);
+    int b = u / ADJ_BLOCK;
+    int k = u % ADJ_BLOCK;
+    AdjBlock* unpacked = data->packed ? unpack_block(data->blocks[b], b * ADJ_BLOCK, data->N) : NULL;
+    const AdjBlock* old_block = data->packed ? unpacked : data->blocks[b];
+    if (old_block == NULL)
+    {
+        pthread_mutex_unlock(&store->write_lock);
+        return(SP_ERR_MEMORY);
+    }
+
+    int found = -1;
+    for (int i = old_block->start[k]; i < old_block->start[k + 1]; i++)
+    {
+        if (old_block->edges[i].vt == v)
+        {
+            found = i;
+            break;
+        }
+    }
+
+    // Copy only the block holding u
+    AdjBlock* block;
+    if (found != -1)
+    {
+        block = alloc_block(old_block->edge_num);
+        if (block == NULL)
+        {
+            free(unpacked);
+            pthread_mutex_unlock(&store->write_lock);
+            return(SP_ERR_MEMORY);
+        }
+        memcpy(block->start, old_block->start, sizeof(block->start));
+        memcpy(block->edges, old_block->edges, old_block->edge_num * sizeof(Edge));
+    }
+    else
+    {
+        found = old_block->start[k + 1]; // Append after the other edges of u
+        block = alloc_block(old_block->edge_num + 1);
+        if (block == NULL)
+        {
+            free(unpacked);
+            pthread_mutex_unlock(&store->write_lock);
+            return(SP_ERR_MEMORY);
+        }
+        for (int j = 0; j <= ADJ_BLOCK; j++)
+        {
+            block->start[j] = old_block->start[j] + (j > k ? 1 : 0);
+        }
+        memcpy(block->edges, old_block->edges, found * sizeof(Edge));
+        memcpy(block->edges + found + 1, old_block->edges + found, (old_block->edge_num - found) * sizeof(Edge));
+        block->edges[found].vs = u;
+        block->edges[found].vt = v;
+    }
+
+    for (int j = 0; j < data->N; j++)
+    {
+        block->edges[found].weights[j] = weights[j];
+    }
+
+    int edge_num = data->edge_num + (block->edge_num - old_block->edge_num);
+    block = repack_block(data, b, block, unpacked);
+    Data* next = (block == NULL) ? NULL : clone_version(data, b, block);
+    if (next == NULL)
+    {
+        free(block);
+        pthread_mutex_unlock(&store->write_lock);
+        return(SP_ERR_MEMORY);
+    }
+
+    next->edge_num = edge_num;
+    publish_version(store, next);
+
+    pthread_mutex_unlock(&store->write_lock);
+    return(SP_OK);
+}
+
+int graph_remove_edge(GraphStore* store, int vs, int vt)
+{
+    // Remove edge vs -> vt (graph file ids)
+    pthread_mutex_lock(&store->write_lock);
+    Data* data = atomic_load(&store->current);
+    if (vs < 0 || vs >= data->V || vt < 0 || vt >= data->V)
+    {
+        pthread_mutex_unlock(&store->write_lock);
+        return(SP_ERR_RANGE);
+    }
+
+    int u = internal_id(data, vs);
+    int v = internal_id(data, vt);
+    int b = u / ADJ_BLOCK;
+    int k = u % ADJ_BLOCK;
+    AdjBlock* unpacked = data->packed ? unpack_block(data->blocks[b], b * ADJ_BLOCK, data->N) : NULL;
+    const AdjBlock* old_block = data->packed ? unpacked : data->blocks[b];
+    if (old_block == NULL)
+    {
+        pthread_mutex_unlock(&store->write_lock);
+        return(SP_ERR_MEMORY);
+    }
+
+    int found = -1;
+    for (int i = old_block->start[k]; i < old_block->start[k + 1]; i++)
+    {
+        if (old_block->edges[i].vt == v)
+        {
+            found = i;
+            break;
+        }
+    }
+
+    if (found == -1)
+    {
+        free(unpacked);
+        pthread_mutex_unlock(&store->write_lock);
+        return(SP_ERR_NOT_FOUND);
+    }
+
+    AdjBlock* block = alloc_block(old_block->edge_num - 1);
+    if (block == NULL)
+    {
+        free(unpacked);
+        pthread_mutex_unlock(&store->write_lock);
+        return(SP_ERR_MEMORY);
+    }
+    for (int j = 0; j <= ADJ_BLOCK; j++)
+    {
+        block->start[j] = old_block->start[j] - (j > k ? 1 : 0);
+    }
+    memcpy(block->edges, old_block->edges, found * sizeof(Edge));
+    memcpy(block->edges + found, old_block->edges + found + 1, (old_block->edge_num - found - 1) * sizeof(Edge));
+
+    block = repack_block(data, b, block, unpacked);
+    Data* next = (block == NULL) ? NULL : clone_version(data, b, block);
+    if (next == NULL)
+    {
+        free(block);
+        pthread_mutex_unlock(&store->write_lock);
+        return(SP_ERR_MEMORY);
+    }
+
+    next->edge_num = data->edge_num - 1;
+    publish_version(store, next);
+
+    pthread_mutex_unlock(&store->write_lock);
+    return(SP_OK);
+}
+
+sp_graph* sp_graph_load_buffer(const char *text, size_t length, int options, int *status)
+{
+    int result;
+    if (status == NULL)
+    {
+        status = &result;
+    }
+
+    sp_graph* graph = (sp_graph*)malloc(sizeof(sp_graph));
+    if (graph == NULL)
+    {
+        *status = SP_ERR_MEMORY;
+        return(NULL);
+    }
+
+    Data* data = read_data(text, length, options, status);
+    if (data == NULL)
+    {
+        free(graph);
+        return(NULL);
+    }
+
+    graph->V = data->V;
+    graph->N = data->N;
+    graph_store_init(&graph->store, data);
+    return(graph);
+}
+
+sp_graph* sp_graph_load(const char *filename, int options, int *status)
+{
+    // Parse the file straight from a read-only mapping
+    int result;
+    if (status == NULL)
+    {
+        status = &result;
+    }
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        *status = SP_ERR_IO;
+        return(NULL);
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == -1)
+    {
+        close(fd);
+        *status = SP_ERR_IO;
+        return(NULL);
+    }
+
+    if (info.st_size == 0)
+    {
+        close(fd);
+        *status = SP_ERR_FORMAT;
+        return(NULL);
+    }
+
+    void *text = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED)
+    {
+        *status = SP_ERR_IO;
+        return(NULL);
+    }
+
+    posix_madvise(text, info.st_size, POSIX_MADV_SEQUENTIAL);
+    sp_graph* graph = sp_graph_load_buffer((const char*)text, info.st_size, options, status);
+    munmap(text, info.st_size);
+    return(graph);
+}
+
+void sp_graph_free(sp_graph *graph)
+{
+    if (graph != NULL)
+    {
+        graph_store_destroy(&graph->store);
+        free(graph);
+    }
+}
+
+int sp_graph_vertices(const sp_graph *graph)
+{
+    // Cached at load time: the current version may be replaced (and freed) at any moment
+    return(graph->V);
+}
+
+int sp_graph_weights(const sp_graph *graph)
+{
+    return(graph->N);
+}
+
+size_t sp_graph_adjacency_bytes(sp_graph *graph)
+{
+    // Memory held by the adjacency blocks of the current version
+    Data* data = graph_acquire(&graph->store);
+    size_t bytes = data->num_blocks * sizeof(AdjBlock*);
+    for (int b = 0; b < data->num_blocks; b++)
+    {
+        bytes += sizeof(AdjBlock) + data->blocks[b]->bytes;
+    }
+    graph_release(data);
+    return(bytes);
+}
+
+long sp_graph_version(sp_graph *graph)
+{
+    Data* data = graph_acquire(&graph->store);
+    long version = data->version;
+    graph_release(data);
+    return(version);
+}
+
+int sp_graph_out_edges(sp_graph *graph, int vertex, int *targets, int *weights, int capacity)
+{
+    Data* data = graph_acquire(&graph->store);
+    if (vertex < 0 || vertex >= data->V)
+    {
+        graph_release(data);
+        return(SP_ERR_RANGE);
+    }
+
+    int u = internal_id(data, vertex);
+    EdgeCursor edges;
+    int v;
+    int weight;
+    int count = 0;
+    for (edges_begin(&edges, data, u, data->packed); edges_next(&edges, 0, &v, &weight, data->packed); count++)
+    {
+        if (count < capacity)
+        {
+            int i = edges.i - 1; // Edge just decoded
+            targets[count] = external_id(data, v);
+            for (int j = 0; j < data->N; j++)
+            {
+                weights[count * data->N + j] = data->packed ? packed_weight(edges.block, i, j) : edges.block->edges[i].weights[j];
+            }
+        }
+    }
+
+    graph_release(data);
+    return(count);
+}
+
+int sp_graph_set_edge(sp_graph *graph, int vs, int vt, const int *weights)
+{
+    return(graph_set_edge(&graph->store, vs, vt, weights));
+}
+
+int sp_graph_remove_edge(sp_graph *graph, int vs, int vt)
+{
+    return(graph_remove_edge(&graph->store, vs, vt));
+}
+
+sp_query* sp_query_create(sp_graph *graph)
+{
+    sp_query* query = (sp_query*)calloc(1, sizeof(sp_query));
+    if (query == NULL)
+    {
+        return(NULL);
+    }
+
+    query->graph = graph;
+    query->rev_version = -1;
+    query->states = sp_graph_vertices(graph) * ADDON;
+    query->distance = (int*)malloc(query->states * sizeof(int));
+    query->previous = (int*)malloc(query->states * sizeof(int));
+    query->hops = (int*)malloc(query->states * sizeof(int));
+    query->minheap = build_heap(query->states);
+    if (query->distance == NULL || query->previous == NULL || query->hops == NULL || query->minheap == NULL)
+    {
+        sp_query_free(query);
+        return(NULL);
+    }
+
+    return(query);
+}
+
+int sp_query_set_threads(sp_query *query, int threads)
+{
+    if (threads < 0 || threads > SP_MAX_THREADS)
+    {
+        return(SP_ERR_RANGE);
+    }
+
+    query->threads = threads;
+    return(SP_OK);
+}
+
+void sp_query_free(sp_query *query)
+{
+    if (query == NULL)
+    {
+        return;
+    }
+
+    if (query->minheap != NULL)
+    {
+        free(query->minheap->arr);
+        free(query->minheap);
+    }
+    free(query->distance);
+    free(query->previous);
+    free(query->hops);
+    free(query->lane_distance);
+    free(query->lane_previous);
+    free(query->lane_hops);
+    free(query->pending);
+    free(query->state_stamp);
+    free(query->vertex_stamp);
+    free(query->rev_start);
+    free(query->rev_source);
+    free(query->rev_weights);
+    free(query->bound);
+    for (int t = 0; t < KSP_THREADS; t++)
+    {
+        free(query->ksp[t].g);
+        free(query->ksp[t].parent);
+        free(query->ksp[t].seen);
+        free(query->ksp[t].blocked);
+        if (query->ksp[t].heap != NULL)
+        {
+            free(query->ksp[t].heap->arr);
+            free(query->ksp[t].heap);
+        }
+    }
+    free(query);
+}
+
+int sp_query_path(sp_query *query, int source, int destination, int *distance, int *path, int capacity, int *length)
+{
+    Data* data = graph_acquire(&query->graph->store); // The whole query runs on one version
+    if (source < 0 || source >= data->V || destination < 0 || destination >= data->V)
+    {
+        graph_release(data);
+        return(SP_ERR_RANGE);
+    }
+
+    dijkstra(internal_id(data, source), data, query); // Dijkstra's algorithm
+
+    int layers = STEP_LAYERS(data->N);
+    int dest = internal_id(data, destination);
+    int step = best_step(query->distance, 1, 0, dest, layers);
+    int status = SP_OK;
+
+    *distance = INF;
+    *length = 0;
+    if (step != -1)
+    {
+        *distance = query->distance[dest * layers + step];
+        *length = write_path(data, query->previous, 1, 0, dest * layers + step, path, capacity);
+        status = (*length > capacity) ? SP_ERR_BUFFER : SP_OK;
+    }
+
+    graph_release(data);
+    return(status);
+}
+
+int sp_query_one_to_many(sp_query *query, int source, const int *targets, int count, int *distances)
+{
+    Data* data = graph_acquire(&query->graph->store);
+    if (source < 0 || source >= data->V)
+    {
+        graph_release(data);
+        return(SP_ERR_RANGE);
+    }
+
+    dijkstra(internal_id(data, source), data, query); // One search serves every target
+
+    int layers = STEP_LAYERS(data->N);
+    int status = SP_OK;
+    for (int i = 0; i < count; i++)
+    {
+        distances[i] = INF;
+        if (targets[i] < 0 || targets[i] >= data->V)
+        {
+            status = SP_ERR_RANGE;
+            continue;
+        }
+
+        int dest = internal_id(data, targets[i]);
+        int step = best_step(query->distance, 1, 0, dest, layers);
+        if (step != -1)
+        {
+            distances[i] = query->distance[dest * layers + step];
+        }
+    }
+
+    graph_release(data);
+    return(status);
+}
+
+int sp_query_profile(sp_query *query, int source, int destination, int *distances, int *paths, int capacity, int *lengths)
+{
+    Data* data = graph_acquire(&query->graph->store);
+    if (source < 0 || source >= data->V || destination < 0 || destination >= data->V)
+    {
+        graph_release(data);
+        return(SP_ERR_RANGE);
+    }
+
+    int n = data->N;
+    if (query->pending == NULL) // Lanes are only needed by profile queries
+    {
+        query->lane_distance = (int*)malloc(query->states * n * sizeof(int));
+        query->lane_previous = (int*)malloc(query->states * n * sizeof(int));
+        query->lane_hops = (int*)malloc(query->states * n * sizeof(int));
+        query->pending = (int*)malloc(query->states * sizeof(int));
+        if (query->lane_distance == NULL || query->lane_previous == NULL || query->lane_hops == NULL || query->pending == NULL)
+        {
+            free(query->lane_distance);
+            free(query->lane_previous);
+            free(query->lane_hops);
+            free(query->pending);
+            query->lane_distance = query->lane_previous = query->lane_hops = query->pending = NULL;
+            graph_release(data);
+            return(SP_ERR_MEMORY);
+        }
+    }
+
+    profile(internal_id(data, source), data, query);
+
+    // Best step at the destination and path for every phase
+    int layers = STEP_LAYERS(n);
+    int dest = internal_id(data, destination);
+    int status = SP_OK;
+    for (int p = 0; p < n; p++)
+    {
+        int step = best_step(query->lane_distance, n, p, dest, layers);
+        distances[p] = INF;
+        lengths[p] = 0;
+        if (step != -1)
+        {
+            distances[p] = query->lane_distance[(dest * layers + step) * n + p];
+            lengths[p] = write_path(data, query->lane_previous, n, p, dest * layers + step, paths + p * capacity, capacity);
+            if (lengths[p] > capacity)
+            {
+                status = SP_ERR_BUFFER;
+            }
+        }
+    }
+
+    graph_release(data);
+    return(status);
+}
+
+int sp_query_range(sp_query *query, int source, int budget, int *vertices, int *distances, int *steps, int capacity, int *count)
+{
+    Data* data = graph_acquire(&query->graph->store);
+    *count = 0;
+    if (source < 0 || source >= data->V || budget < 0)
+    {
+        graph_release(data);
+        return(SP_ERR_RANGE);
+    }
+
+    if (query->state_stamp == NULL || query->generation == INT_MAX / 2 - 1)
+    {
+        // First range query, or the generation counter is about to overflow: start from clean stamps
+        free(query->state_stamp);
+        free(query->vertex_stamp);
+        query->state_stamp = (int*)calloc(query->states, sizeof(int));
+        query->vertex_stamp = (int*)calloc(data->V, sizeof(int));
+        query->generation = 0;
+        if (query->state_stamp == NULL || query->vertex_stamp == NULL)
+        {
+            free(query->state_stamp);
+            free(query->vertex_stamp);
+            query->state_stamp = query->vertex_stamp = NULL;
+            graph_release(data);
+            return(SP_ERR_MEMORY);
+        }
+    }
+    query->generation++;
+
+    *count = data->range(internal_id(data, source), budget, data, query, vertices, distances, steps, capacity);
+
+    graph_release(data);
+    return((*count > capacity) ? SP_ERR_BUFFER : SP_OK);
+}
+
+// k shortest paths (Yen's algorithm over (vertex, step) states). The first path is the one
+// sp_query_path finds, with its prefix distances read off the forward search tree. A reverse
+// search from the destination then gives the exact distance from every state to it; with that
+// as the A* heuristic a spur search only leaves the reverse shortest path where the deviation
+// forces it to, so each costs a handful of expansions instead of a full search. The spur
+// searches of a round are independent and run on up to KSP_THREADS threads.
+
+typedef struct
+{
+    int *states; // Source first, destination state last
+    int *costs; // Distance from the source to each state
+    int length; // Number of states
+    int distance; // Total distance
+} KPath;
+
+typedef struct
+{
+    const Data *data; // Version the query runs on
+    const int *bound; // Exact distance from every state to the destination
+    int dest; // Destination vertex (internal id)
+    const KPath *accepted; // Paths found so far
+    int num_accepted;
+    const KPath *last; // Newest accepted path, whose states are the spur states
+    atomic_int next_spur; // Next spur index to claim
+    KPath *spurs; // Candidate found from spur index i (length 0 if none)
+    atomic_int status; // SP_ERR_MEMORY if a spur search ran out of memory
+} KspRound;
+
+typedef struct
+{
+    KspRound *round;
+    KspScratch *scratch;
+} KspThread;
+
+int ksp_scratch_init(KspScratch* scratch, int states)
+{
+    if (scratch->heap != NULL)
+    {
+        return(SP_OK);
+    }
+
+    scratch->g = (int*)malloc(states * sizeof(int));
+    scratch->parent = (int*)malloc(states * sizeof(int));
+    scratch->seen = (int*)calloc(states, sizeof(int));
+    scratch->blocked = (int*)calloc(states, sizeof(int));
+    scratch->generation = 0;
+    scratch->heap = build_heap(1024);
+    if (scratch->g == NULL || scratch->parent == NULL || scratch->seen == NULL || scratch->blocked == NULL || scratch->heap == NULL)
+    {
+        free(scratch->g);
+        free(scratch->parent);
+        free(scratch->seen);
+        free(scratch->blocked);
+        if (scratch->heap != NULL)
+        {
+            free(scratch->heap->arr);
+            free(scratch->heap);
+        }
+        memset(scratch, 0, sizeof(KspScratch));
+        return(SP_ERR_MEMORY);
+    }
+
+    return(SP_OK);
+}
+
+void free_kpath(KPath* path)
+{
+    free(path->states);
+    free(path->costs);
+    path->states = path->costs = NULL;
+    path->length = 0;
+}
+
+int build_reverse(const Data* data, sp_query* query)
+{
+    // Incoming edges of every vertex, kept until the graph version changes
+    if (query->rev_version == data->version && query->rev_start != NULL)
+    {
+        return(SP_OK);
+    }
+
+    free(query->rev_start);
+    free(query->rev_source);
+    free(query->rev_weights);
+    query->rev_start = (int*)calloc(data->V + 1, sizeof(int));
+    query->rev_source = (int*)malloc((data->edge_num + 1) * sizeof(int));
+    query->rev_weights = (int*)malloc(((size_t)data->edge_num + 1) * data->N * sizeof(int));
+    query->rev_version = -1;
+    if (query->rev_start == NULL || query->rev_source == NULL || query->rev_weights == NULL)
+    {
+        free(query->rev_start);
+        free(query->rev_source);
+        free(query->rev_weights);
+        query->rev_start = query->rev_source = query->rev_weights = NULL;
+        return(SP_ERR_MEMORY);
+    }
+
+    EdgeCursor edges;
+    int v;
+    int weight;
+    for (int u = 0; u < data->V; u++)
+    {
+        for (edges_begin(&edges, data, u, data->packed); edges_next(&edges, 0, &v, &weight, data->packed); )
+        {
+            query->rev_start[v + 1]++;
+        }
+    }
+    for (int u = 0; u < data->V; u++)
+    {
+        query->rev_start[u + 1] += query->rev_start[u];
+    }
+
+    int *fill = (int*)malloc(data->V * sizeof(int));
+    if (fill == NULL)
+    {
+        return(SP_ERR_MEMORY);
+    }
+    memcpy(fill, query->rev_start, data->V * sizeof(int));
+    for (int u = 0; u < data->V; u++)
+    {
+        for (edges_begin(&edges, data, u, data->packed); edges_next(&edges, 0, &v, &weight, data->packed); )
+        {
+            int i = edges.i - 1; // Edge just decoded
+            int e = fill[v]++;
+            query->rev_source[e] = u;
+            for (int j = 0; j < data->N; j++)
+            {
+                query->rev_weights[e * data->N + j] = data->packed ? packed_weight(edges.block, i, j) : edges.block->edges[i].weights[j];
+            }
+        }
+    }
+    free(fill);
+
+    query->rev_version = data->version;
+    return(SP_OK);
+}
+
+int reverse_bounds(const Data* data, sp_query* query, int dest)
+{
+    // Dijkstra backwards from every step of the destination. Paths end at their first visit to
+    // the destination, so nothing is relaxed through it.
+    int layers = STEP_LAYERS(data->N);
+    int states = data->V * layers;
+    int *bound = query->bound;
+    for (int i = 0; i < states; i++)
+    {
+        bound[i] = INF;
+    }
+
+    Heap* minheap = query->minheap;
+    minheap->curr_size = 0;
+    for (int step = 0; step < layers; step++)
+    {
+        bound[dest * layers + step] = 0;
+        Node node = {dest * layers + step, 0, step};
+        insert_node(minheap, node); // Fits: the heap holds V * ADDON nodes
+    }
+
+    while (minheap->curr_size > 0)
+    {
+        Node minNode = extract_min(minheap);
+        if (minNode.distance > bound[minNode.vertex])
+        {
+            continue; // Stale entry
+        }
+
+        int v = minNode.vertex / layers;
+        int prev_step = (minNode.step + layers - 1) % layers; // Step of the states leading here
+        int weight_ind = prev_step % data->N;
+        for (int e = query->rev_start[v]; e < query->rev_start[v + 1]; e++)
+        {
+            int u = query->rev_source[e];
+            int state = u * layers + prev_step;
+            int candidate = minNode.distance + query->rev_weights[e * data->N + weight_ind];
+            if (u != dest && candidate < bound[state])
+            {
+                bound[state] = candidate;
+                Node node = {state, candidate, prev_step};
+                if (insert_node(minheap, node) != SP_OK)
+                {
+                    return(SP_ERR_MEMORY);
+                }
+            }
+        }
+    }
+
+    return(SP_OK);
+}
+
+int spur_search(KspRound* round, KspScratch* scratch, int i)
+{
+    // Shortest path that shares the first i + 1 states of the last accepted path and then leaves
+    // it through an edge no accepted path with the same prefix has taken
+    const Data* data = round->data;
+    const KPath* last = round->last;
+    const int *bound = round->bound;
+    int layers = STEP_LAYERS(data->N);
+    int spur = last->states[i];
+    KPath* result = &round->spurs[i];
+    result->length = 0;
+    if (bound[spur] == INF)
+    {
+        return(SP_OK);
+    }
+
+    int generation = ++(scratch->generation);
+    for (int j = 0; j < i; j++)
+    {
+        scratch->blocked[last->states[j]] = generation; // Keep the path loopless
+    }
+
+    int removed[round->num_accepted];
+    int num_removed = 0;
+    for (int p = 0; p < round->num_accepted; p++)
+    {
+        const KPath* other = &round->accepted[p];
+        if (other->length > i + 1 && memcmp(other->states, last->states, (i + 1) * sizeof(int)) == 0)
+        {
+            removed[num_removed++] = other->states[i + 1];
+        }
+    }
+
+    Heap* heap = scratch->heap;
+    heap->curr_size = 0;
+    scratch->seen[spur] = generation;
+    scratch->g[spur] = last->costs[i];
+    scratch->parent[spur] = -1;
+    Node start = {spur, last->costs[i] + bound[spur], spur % layers};
+    insert_node(heap, start); // An empty heap always has room
+
+    int found = -1;
+    while (heap->curr_size > 0)
+    {
+        Node minNode = extract_min(heap);
+        int state = minNode.vertex;
+        if (minNode.distance > scratch->g[state] + bound[state])
+        {
+            continue; // Stale entry
+        }
+
+        int u = state / layers;
+        if (u == round->dest)
+        {
+            found = state;
+            break;
+        }
+
+        int weight_ind = minNode.step % data->N;
+        int next_step = (minNode.step + 1) % layers;
+        EdgeCursor edges;
+        int v;
+        int weight;
+        for (edges_begin(&edges, data, u, data->packed); edges_next(&edges, weight_ind, &v, &weight, data->packed); )
+        {
+            int next = v * layers + next_step;
+            if (bound[next] == INF || scratch->blocked[next] == generation)
+            {
+                continue;
+            }
+
+            int skip = 0;
+            for (int r = 0; r < num_removed && state == spur; r++)
+            {
+                skip |= (removed[r] == next);
+            }
+            if (skip)
+            {
+                continue;
+            }
+
+            int g = scratch->g[state] + weight;
+            if (scratch->seen[next] != generation || g < scratch->g[next])
+            {
+                scratch->seen[next] = generation;
+                scratch->g[next] = g;
+                scratch->parent[next] = state;
+                Node node = {next, g + bound[next], next_step};
+                if (insert_node(heap, node) != SP_OK)
+                {
+                    return(SP_ERR_MEMORY);
+                }
+            }
+        }
+    }
+
+    if (found == -1)
+    {
+        return(SP_OK);
+    }
+
+    int spur_length = 0;
+    for (int state = found; state != -1; state = scratch->parent[state])
+    {
+        spur_length++;
+    }
+
+    result->states = (int*)malloc((i + spur_length) * sizeof(int));
+    result->costs = (int*)malloc((i + spur_length) * sizeof(int));
+    if (result->states == NULL || result->costs == NULL)
+    {
+        free_kpath(result);
+        return(SP_ERR_MEMORY);
+    }
+
+    memcpy(result->states, last->states, i * sizeof(int));
+    memcpy(result->costs, last->costs, i * sizeof(int));
+    int index = i + spur_length;
+    for (int state = found; state != -1; state = scratch->parent[state])
+    {
+        index--;
+        result->states[index] = state;
+        result->costs[index] = scratch->g[state];
+    }
+    result->length = i + spur_length;
+    result->distance = scratch->g[found];
+    return(SP_OK);
+}
+
+void* spur_thread(void *arg)
+{
+    KspThread* thread = (KspThread*)arg;
+    KspRound* round = thread->round;
+    for (int i = atomic_fetch_add(&round->next_spur, 1); i < round->last->length - 1; i = atomic_fetch_add(&round->next_spur, 1))
+    {
+        if (spur_search(round, thread->scratch, i) != SP_OK)
+        {
+            atomic_store(&round->status, SP_ERR_MEMORY);
+        }
+    }
+
+    return(NULL);
+}
+
+int same_kpath(const KPath* a, const KPath* b)
+{
+    return(a->distance == b->distance && a->length == b->length && memcmp(a->states, b->states, a->length * sizeof(int)) == 0);
+}
+
+int sp_query_k_paths(sp_query *query, int source, int destination, int k, int *distances, int *paths, int capacity, int *lengths, int *count)
+{
+    Data* data = graph_acquire(&query->graph->store);
+    *count = 0;
+    if (source < 0 || source >= data->V || destination < 0 || destination >= data->V || k < 1)
+    {
+        graph_release(data);
+        return(SP_ERR_RANGE);
+    }
+
+    int layers = STEP_LAYERS(data->N);
+    int src = internal_id(data, source);
+    int dest = internal_id(data, destination);
+    dijkstra(src, data, query); // First path and its prefix distances
+    int step = best_step(query->distance, 1, 0, dest, layers);
+    if (step == -1)
+    {
+        graph_release(data);
+        return(SP_OK); // Unreachable: no paths at all
+    }
+
+    KPath *accepted = (KPath*)calloc(k, sizeof(KPath));
+    if (accepted == NULL)
+    {
+        graph_release(data);
+        return(SP_ERR_MEMORY);
+    }
+
+    int length = 0;
+    for (int state = dest * layers + step; state != -1; state = query->previous[state])
+    {
+        length++;
+    }
+    accepted[0].states = (int*)malloc(length * sizeof(int));
+    accepted[0].costs = (int*)malloc(length * sizeof(int));
+    accepted[0].length = length;
+    accepted[0].distance = query->distance[dest * layers + step];
+    int status = (accepted[0].states == NULL || accepted[0].costs == NULL) ? SP_ERR_MEMORY : SP_OK;
+    for (int state = dest * layers + step; status == SP_OK && state != -1; state = query->previous[state])
+    {
+        length--;
+        accepted[0].states[length] = state;
+        accepted[0].costs[length] = query->distance[state];
+    }
+    for (int j = 0; status == SP_OK && j < accepted[0].length; j++)
+    {
+        if (accepted[0].states[j] / layers == dest)
+        {
+            // The tie rule may pass the destination before the chosen step at the same distance
+            accepted[0].length = j + 1;
+            accepted[0].distance = accepted[0].costs[j];
+            break;
+        }
+    }
+    int num_accepted = 1;
+
+    if (status == SP_OK && k > 1)
+    {
+        if (query->bound == NULL)
+        {
+            query->bound = (int*)malloc(query->states * sizeof(int));
+        }
+        status = (query->bound == NULL) ? SP_ERR_MEMORY : build_reverse(data, query);
+    }
+    if (status == SP_OK && k > 1)
+    {
+        status = reverse_bounds(data, query, dest);
+    }
+
+    int max_threads = query->threads;
+    if (max_threads == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        max_threads = (cpus < 1) ? 1 : (cpus > KSP_THREADS) ? KSP_THREADS : (int)cpus;
+    }
+    KPath *candidates = NULL;
+    int num_candidates = 0;
+    int candidate_capacity = 0;
+    while (status == SP_OK && num_accepted < k)
+    {
+        // One Yen round: a spur search from every state of the newest path but its last
+        KspRound round;
+        round.data = data;
+        round.bound = query->bound;
+        round.dest = dest;
+        round.accepted = accepted;
+        round.num_accepted = num_accepted;
+        round.last = &accepted[num_accepted - 1];
+        atomic_init(&round.next_spur, 0);
+        atomic_init(&round.status, SP_OK);
+        round.spurs = (KPath*)calloc(round.last->length, sizeof(KPath));
+        if (round.spurs == NULL)
+        {
+            status = SP_ERR_MEMORY;
+            break;
+        }
+
+        int threads = (round.last->length - 1 < max_threads) ? round.last->length - 1 : max_threads;
+        KspThread args[KSP_THREADS];
+        pthread_t workers[KSP_THREADS];
+        int started = 0;
+        for (int t = 0; t < threads && status == SP_OK; t++)
+        {
+            status = ksp_scratch_init(&query->ksp[t], query->states);
+            args[t].round = &round;
+            args[t].scratch = &query->ksp[t];
+        }
+        for (int t = 1; t < threads && status == SP_OK; t++)
+        {
+            if (pthread_create(&workers[t], NULL, spur_thread, &args[t]) != 0)
+            {
+                break; // The threads already running and this one share the work
+            }
+            started = t;
+        }
+        if (status == SP_OK && threads > 0)
+        {
+            spur_thread(&args[0]);
+        }
+        for (int t = 1; t <= started; t++)
+        {
+            pthread_join(workers[t], NULL);
+        }
+        if (status == SP_OK)
+        {
+            status = atomic_load(&round.status);
+        }
+
+        // Merge in spur order so the result does not depend on the thread count
+        for (int i = 0; i < round.last->length; i++)
+        {
+            KPath* spur = &round.spurs[i];
+            int duplicate = (spur->length == 0);
+            for (int c = 0; c < num_candidates && !duplicate; c++)
+            {
+                duplicate = same_kpath(spur, &candidates[c]);
+            }
+            if (duplicate || status != SP_OK)
+            {
+                free_kpath(spur);
+                continue;
+            }
+
+            if (num_candidates == candidate_capacity)
+            {
+                candidate_capacity = candidate_capacity ? 2 * candidate_capacity : 16;
+                KPath* grown = (KPath*)realloc(candidates, candidate_capacity * sizeof(KPath));
+                if (grown == NULL)
+                {
+                    free_kpath(spur);
+                    status = SP_ERR_MEMORY;
+                    continue;
+                }
+                candidates = grown;
+            }
+            candidates[num_candidates++] = *spur;
+        }
+        free(round.spurs);
+
+        if (status != SP_OK || num_candidates == 0)
+        {
+            break; // Fewer than k paths exist
+        }
+
+        int best = 0;
+        for (int c = 1; c < num_candidates; c++)
+        {
+            if (candidates[c].distance < candidates[best].distance)
+            {
+                best = c; // Earliest found wins ties
+            }
+        }
+        accepted[num_accepted++] = candidates[best];
+        memmove(candidates + best, candidates + best + 1, (num_candidates - best - 1) * sizeof(KPath));
+        num_candidates--;
+    }
+
+    for (int c = 0; c < num_candidates; c++)
+    {
+        free_kpath(&candidates[c]);
+    }
+    free(candidates);
+
+    if (status == SP_OK)
+    {
+        *count = num_accepted;
+        for (int p = 0; p < num_accepted; p++)
+        {
+            distances[p] = accepted[p].distance;
+            lengths[p] = accepted[p].length;
+            if (accepted[p].length > capacity)
+            {
+                status = SP_ERR_BUFFER;
+                continue;
+            }
+            for (int j = 0; j < accepted[p].length; j++)
+            {
+                paths[p * capacity + j] = external_id(data, accepted[p].states[j] / layers);
+            }
+        }
+    }
+
+    for (int p = 0; p < num_accepted; p++)
+    {
+        free_kpath(&accepted[p]);
+    }
+    free(accepted);
+    graph_release(data);
+    return(status);
+}
+
+// Out-of-core engine. sp_ooc_build writes the adjacency to a store file as compressed blocks,
+// each starting on a page boundary, with the block directory and vertex relabeling at the end.
+// sp_ooc_open keeps only the directory, the relabeling and the per-state search arrays in
+// memory; blocks are read with pread into a CLOCK cache of bounded size, and a background
+// thread reads ahead the blocks of the states at the top of the priority queue.
+
+#define OOC_MAGIC "SPOOC01"
+#define OOC_PAGE 4096 // Blocks start on page boundaries
+#define OOC_PREFETCH_DEPTH 8 // Heap entries whose blocks are read ahead
+#define OOC_QUEUE 256 // Pending prefetch requests
+#define OOC_RUN_EDGES (1 << 18) // Edges per run of consecutive blocks sorted in memory at build time
+#define OOC_BUCKET_EDGES 1024 // Edges buffered per run before they are appended to the temporary file
+
+#define BLOCK_ABSENT 0
+#define BLOCK_LOADING 1
+#define BLOCK_CACHED 2
+
+typedef struct
+{
+    char magic[8]; // OOC_MAGIC
+    int V; // Number of vertices
+    int N; // Number of edge weights
+    int num_blocks; // Number of adjacency blocks
+    int ordered; // Vertices were relabeled (the maps follow the directory)
+    long long edge_num; // Number of edges
+    long long directory_offset; // num_blocks x OocEntry
+    long long maps_offset; // new_to_old[V] then old_to_new[V] (if ordered)
+} OocHeader;
+
+typedef struct
+{
+    long long offset; // Page-aligned file offset of the block
+    long long length; // Bytes (an AdjBlock followed by its storage)
+} OocEntry;
+
+struct sp_ooc
+{
+    int fd; // Store file
+    int V; // Number of vertices
+    int N; // Number of edge weights
+    int layers; // Step layers per vertex
+    int num_blocks; // Number of adjacency blocks
+    OocEntry *directory; // Where each block is
+    int *old_to_new; // Graph file id -> internal id (NULL if not relabeled)
+    int *new_to_old; // Internal id -> graph file id (NULL if not relabeled)
+
+    pthread_mutex_t lock; // Protects everything below
+    pthread_cond_t loaded; // Signalled when a block becomes resident
+    pthread_cond_t wake; // Signalled when there is prefetch work
+    AdjBlock **cached; // Resident blocks (NULL if not resident)
+    unsigned char *block_state; // BLOCK_ABSENT / BLOCK_LOADING / BLOCK_CACHED
+    unsigned char *referenced; // CLOCK reference bits
+    int hand; // CLOCK hand
+    size_t cache_bytes; // Bytes of resident blocks
+    size_t cache_budget; // Most bytes to keep resident
+    int pinned; // Block the search is walking (never evicted)
+    int requests[OOC_QUEUE]; // Prefetch ring buffer
+    int request_head; // Next request to serve
+    int request_count; // Pending requests
+    int stop; // Tells the prefetcher to exit
+    pthread_t prefetcher; // Read-ahead thread
+    sp_io_stats io; // Running I/O counters
+
+    int *distance; // Distance of every state (resident)
+    int *previous; // Predecessor of every state (resident)
+    int *hops; // Edges on the path to every state (resident)
+    Heap *minheap; // Frontier
+};
+
+int write_all(int fd, const void *buffer, size_t length, off_t offset)
+{
+    const char *bytes = (const char*)buffer;
+    while (length > 0)
+    {
+        ssize_t written = pwrite(fd, bytes, length, offset);
+        if (written <= 0)
+        {
+            return(SP_ERR_IO);
+        }
+        bytes += written;
+        length -= written;
+        offset += written;
+    }
+    return(SP_OK);
+}
+
+int read_all(int fd, void *buffer, size_t length, off_t offset)
+{
+    char *bytes = (char*)buffer;
+    while (length > 0)
+    {
+        ssize_t got = pread(fd, bytes, length, offset);
+        if (got <= 0)
+        {
+            return(SP_ERR_IO);
+        }
+        bytes += got;
+        length -= got;
+        offset += got;
+    }
+    return(SP_OK);
+}
+
+long long page_align(long long offset)
+{
+    return((offset + OOC_PAGE - 1) / OOC_PAGE * OOC_PAGE);
+}
+
+int ooc_flush_bucket(int tmp, const Edge *bucket, int *count, long long *written)
+{
+    // Append a run's buffered edges to its region of the temporary file
+    int status = write_all(tmp, bucket, *count * sizeof(Edge), (off_t)(*written * sizeof(Edge)));
+    *written += *count;
+    *count = 0;
+    return(status);
+}
+
+int ooc_build_blocks(const char *text, const char *end, int fd, int tmp, OocHeader* header, const int *new_to_old, const int *old_to_new, const long long *adj_start)
+{
+    // Pass 2: bucket every edge by run (consecutive blocks holding about OOC_RUN_EDGES edges) and
+    // append the buckets to each run's region of a temporary file, so the writes are sequential.
+    // Pass 3: read one run at a time, group it by source vertex and write its compressed blocks at
+    // page boundaries.
+    int V = header->V;
+    int N = header->N;
+    int num_blocks = header->num_blocks;
+    const char *cursor = text;
+    int value;
+    next_int(&cursor, end, &value); // Skip the header
+    next_int(&cursor, end, &value);
+
+    // Cut the blocks into runs
+    int *run_of = (int*)malloc((num_blocks + 1) * sizeof(int)); // Run of each block
+    int *run_first = (int*)malloc((num_blocks + 1) * sizeof(int)); // First block of each run (and num_blocks)
+    int runs = 0;
+    long long longest = 0;
+    if (run_of != NULL && run_first != NULL)
+    {
+        for (int b = 0; b < num_blocks; b++)
+        {
+            long long stop = adj_start[((b + 1) * ADJ_BLOCK < V) ? (b + 1) * ADJ_BLOCK : V];
+            if (runs == 0 || stop - adj_start[run_first[runs - 1] * ADJ_BLOCK] > OOC_RUN_EDGES)
+            {
+                run_first[runs++] = b; // A block bigger than a run gets a run of its own
+            }
+            run_of[b] = runs - 1;
+            long long length = stop - adj_start[run_first[runs - 1] * ADJ_BLOCK];
+            longest = (length > longest) ? length : longest;
+        }
+        run_first[runs] = num_blocks;
+    }
+
+    Edge *buckets = (Edge*)malloc(((size_t)runs * OOC_BUCKET_EDGES + 1) * sizeof(Edge));
+    int *bucket_count = (int*)calloc(runs + 1, sizeof(int));
+    long long *written = (long long*)malloc((runs + 1) * sizeof(long long)); // Next edge slot of each run region
+    OocEntry *directory = (OocEntry*)calloc(num_blocks + 1, sizeof(OocEntry));
+    int status = (run_of && run_first && buckets && bucket_count && written && directory) ? SP_OK : SP_ERR_MEMORY;
+    for (int r = 0; r < runs && status == SP_OK; r++)
+    {
+        written[r] = adj_start[run_first[r] * ADJ_BLOCK];
+    }
+
+    Edge edge;
+    while (status == SP_OK && read_edge(&cursor, end, V, N, &edge) > 0) // Pass 1 validated the text
+    {
+        if (old_to_new != NULL)
+        {
+            edge.vs = old_to_new[edge.vs];
+            edge.vt = old_to_new[edge.vt];
+        }
+
+        int r = run_of[edge.vs / ADJ_BLOCK];
+        buckets[(size_t)r * OOC_BUCKET_EDGES + bucket_count[r]++] = edge;
+        if (bucket_count[r] == OOC_BUCKET_EDGES)
+        {
+            status = ooc_flush_bucket(tmp, buckets + (size_t)r * OOC_BUCKET_EDGES, &bucket_count[r], &written[r]);
+        }
+    }
+
+    for (int r = 0; r < runs && status == SP_OK; r++)
+    {
+        status = ooc_flush_bucket(tmp, buckets + (size_t)r * OOC_BUCKET_EDGES, &bucket_count[r], &written[r]);
+    }
+    free(buckets);
+    free(bucket_count);
+    free(written);
+    free(run_of);
+
+    // Runs are read back whole and grouped with a stable counting sort, so each vertex keeps its graph file edge order
+    Edge *edges = NULL;
+    Edge *run = NULL;
+    long long *fill = NULL;
+    if (status == SP_OK)
+    {
+        edges = (Edge*)malloc((longest + 1) * sizeof(Edge));
+        run = (Edge*)malloc((longest + 1) * sizeof(Edge));
+        fill = (long long*)malloc((V + 1) * sizeof(long long));
+        if (edges == NULL || run == NULL || fill == NULL)
+        {
+            status = SP_ERR_MEMORY;
+        }
+        else
+        {
+            memcpy(fill, adj_start, (V + 1) * sizeof(long long));
+        }
+    }
+
+    long long offset = OOC_PAGE; // Page 0 holds the header
+    for (int r = 0; r < runs && status == SP_OK; r++)
+    {
+        long long run_start = adj_start[run_first[r] * ADJ_BLOCK];
+        long long run_stop = adj_start[(run_first[r + 1] * ADJ_BLOCK < V) ? run_first[r + 1] * ADJ_BLOCK : V];
+        status = read_all(tmp, edges, (run_stop - run_start) * sizeof(Edge), (off_t)(run_start * sizeof(Edge)));
+        if (status == SP_OK)
+        {
+            for (long long i = 0; i < run_stop - run_start; i++)
+            {
+                run[fill[edges[i].vs]++ - run_start] = edges[i];
+            }
+        }
+
+        for (int b = run_first[r]; b < run_first[r + 1] && status == SP_OK; b++)
+        {
+            int first = b * ADJ_BLOCK;
+            int last = (first + ADJ_BLOCK < V) ? first + ADJ_BLOCK : V;
+            AdjBlock* block = alloc_block((int)(adj_start[last] - adj_start[first]));
+            if (block == NULL)
+            {
+                status = SP_ERR_MEMORY;
+                break;
+            }
+            for (int k = 0; k <= ADJ_BLOCK; k++)
+            {
+                int u = (first + k < last) ? first + k : last;
+                block->start[k] = (int)(adj_start[u] - adj_start[first]);
+            }
+            memcpy(block->edges, run + (adj_start[first] - run_start), block->edge_num * sizeof(Edge));
+
+            AdjBlock* packed = pack_block(block, first, N);
+            free(block);
+            if (packed == NULL)
+            {
+                status = SP_ERR_MEMORY;
+                break;
+            }
+
+            directory[b].offset = offset;
+            directory[b].length = sizeof(AdjBlock) + packed->bytes;
+            status = write_all(fd, packed, directory[b].length, offset);
+            offset = page_align(offset + directory[b].length);
+            free(packed);
+        }
+    }
+    free(edges);
+    free(run);
+    free(fill);
+    free(run_first);
+
+    header->directory_offset = offset;
+    if (status == SP_OK)
+    {
+        status = write_all(fd, directory, num_blocks * sizeof(OocEntry), offset);
+    }
+    offset += num_blocks * sizeof(OocEntry);
+
+    header->maps_offset = offset;
+    if (status == SP_OK && header->ordered)
+    {
+        status = write_all(fd, new_to_old, V * sizeof(int), offset);
+        if (status == SP_OK)
+        {
+            status = write_all(fd, old_to_new, V * sizeof(int), offset + V * sizeof(int));
+        }
+    }
+
+    free(directory);
+    return(status);
+}
+
+int sp_ooc_build(const char *graph_file, const char *store_file, int order)
+{
+    // Streams the graph text twice; memory stays O(V) however many edges there are
+    if (order != SP_ORDER_NONE && order != SP_ORDER_DEGREE)
+    {
+        return(SP_ERR_UNSUPPORTED); // BFS / RCM orders need the whole adjacency in memory
+    }
+
+    int in = open(graph_file, O_RDONLY);
+    if (in == -1)
+    {
+        return(SP_ERR_IO);
+    }
+
+    struct stat info;
+    if (fstat(in, &info) == -1 || info.st_size == 0)
+    {
+        close(in);
+        return(SP_ERR_IO);
+    }
+
+    const char *text = (const char*)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, in, 0);
+    close(in);
+    if (text == (const char*)MAP_FAILED)
+    {
+        return(SP_ERR_IO);
+    }
+    posix_madvise((void*)text, info.st_size, POSIX_MADV_SEQUENTIAL);
+    const char *end = text + info.st_size;
+
+    // Pass 1: header and degrees
+    OocHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, OOC_MAGIC, sizeof(header.magic));
+    const char *cursor = text;
+    Data probe; // Only V and N, to validate N like read_data does
+    if (!next_int(&cursor, end, &header.V) || !next_int(&cursor, end, &header.N) || header.V <= 0)
+    {
+        munmap((void*)text, info.st_size);
+        return(SP_ERR_FORMAT);
+    }
+    probe.N = header.N;
+    probe.packed = 1;
+    if (select_kernels(&probe) != SP_OK)
+    {
+        munmap((void*)text, info.st_size);
+        return(SP_ERR_FORMAT);
+    }
+
+    int V = header.V;
+    int *out_degree = (int*)calloc(V, sizeof(int));
+    int *degree = (int*)calloc(V, sizeof(int));
+    long long *adj_start = (long long*)calloc(V + 1, sizeof(long long));
+    int *new_to_old = NULL;
+    int *old_to_new = NULL;
+    int status = (out_degree && degree && adj_start) ? SP_OK : SP_ERR_MEMORY;
+
+    int vs;
+    int vt;
+    int weight;
+    while (status == SP_OK && next_int(&cursor, end, &vs) && next_int(&cursor, end, &vt))
+    {
+        if (vs < 0 || vs >= V || vt < 0 || vt >= V)
+        {
+            status = SP_ERR_FORMAT;
+            break;
+        }
+        out_degree[vs]++;
+        degree[vs]++;
+        degree[vt]++;
+        header.edge_num++;
+        for (int j = 0; j < header.N; j++)
+        {
+            next_int(&cursor, end, &weight);
+        }
+    }
+
+    if (status == SP_OK && order == SP_ORDER_DEGREE)
+    {
+        // Hub-first relabeling, same as reorder_vertices
+        new_to_old = (int*)malloc(V * sizeof(int));
+        old_to_new = (int*)malloc(V * sizeof(int));
+        if (new_to_old == NULL || old_to_new == NULL)
+        {
+            status = SP_ERR_MEMORY;
+        }
+        else
+        {
+            for (int u = 0; u < V; u++)
+            {
+                new_to_old[u] = u;
+            }
+            sort_by_degree(new_to_old, V, degree, 1);
+            for (int i = 0; i < V; i++)
+            {
+                old_to_new[new_to_old[i]] = i;
+            }
+            header.ordered = 1;
+        }
+    }
+
+    if (status == SP_OK)
+    {
+        for (int u = 0; u < V; u++)
+        {
+            int old = (new_to_old != NULL) ? new_to_old[u] : u;
+            adj_start[u + 1] = adj_start[u] + out_degree[old];
+        }
+        header.num_blocks = (V + ADJ_BLOCK - 1) / ADJ_BLOCK;
+
+        char tmp_name[4096];
+        snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", store_file);
+        int fd = open(store_file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        int tmp = open(tmp_name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd == -1 || tmp == -1)
+        {
+            status = SP_ERR_IO;
+        }
+        else
+        {
+            unlink(tmp_name); // Gone once closed
+            status = ooc_build_blocks(text, end, fd, tmp, &header, new_to_old, old_to_new, adj_start);
+            if (status == SP_OK)
+            {
+                status = write_all(fd, &header, sizeof(header), 0);
+            }
+        }
+
+        if (tmp != -1)
+        {
+            close(tmp);
+        }
+        if (fd != -1 && close(fd) != 0 && status == SP_OK)
+        {
+            status = SP_ERR_IO;
+        }
+    }
+
+    free(out_degree);
+    free(degree);
+    free(adj_start);
+    free(new_to_old);
+    free(old_to_new);
+    munmap((void*)text, info.st_size);
+    return(status);
+}
+
+AdjBlock* ooc_read_block(sp_ooc* ooc, int b)
+{
+    // Read a block from the store; NULL on I/O errors
+    AdjBlock* block = (AdjBlock*)malloc(ooc->directory[b].length);
+    if (block == NULL || read_all(ooc->fd, block, ooc->directory[b].length, ooc->directory[b].offset) != SP_OK)
+    {
+        free(block);
+        return(NULL);
+    }
+
+    atomic_init(&block->refs, 1);
+    return(block);
+}
+
+void ooc_insert(sp_ooc* ooc, int b, AdjBlock* block, int prefetched)
+{
+    // Make block resident (called with the lock held), evicting with CLOCK to stay in budget
+    size_t size = ooc->directory[b].length;
+    for (int scanned = 0; ooc->cache_bytes + size > ooc->cache_budget && scanned < 2 * ooc->num_blocks; scanned++)
+    {
+        int victim = ooc->hand;
+        ooc->hand = (ooc->hand + 1) % ooc->num_blocks;
+        if (ooc->block_state[victim] != BLOCK_CACHED || victim == ooc->pinned)
+        {
+            continue;
+        }
+        if (ooc->referenced[victim])
+        {
+            ooc->referenced[victim] = 0; // Second chance
+            continue;
+        }
+
+        ooc->cache_bytes -= ooc->directory[victim].length;
+        free(ooc->cached[victim]);
+        ooc->cached[victim] = NULL;
+        ooc->block_state[victim] = BLOCK_ABSENT;
+    }
+
+    ooc->cached[b] = block;
+    ooc->block_state[b] = (block != NULL) ? BLOCK_CACHED : BLOCK_ABSENT;
+    ooc->referenced[b] = 1;
+    if (block != NULL)
+    {
+        ooc->cache_bytes += size;
+        ooc->io.reads++;
+        ooc->io.bytes_read += size;
+        ooc->io.prefetched += prefetched;
+    }
+    pthread_cond_broadcast(&ooc->loaded);
+}
+
+void* ooc_prefetcher(void *arg)
+{
+    sp_ooc* ooc = (sp_ooc*)arg;
+    pthread_mutex_lock(&ooc->lock);
+    while (1)
+    {
+        while (ooc->request_count == 0 && !ooc->stop)
+        {
+            pthread_cond_wait(&ooc->wake, &ooc->lock);
+        }
+        if (ooc->stop)
+        {
+            break;
+        }
+
+        int b = ooc->requests[ooc->request_head];
+        ooc->request_head = (ooc->request_head + 1) % OOC_QUEUE;
+        ooc->request_count--;
+        if (ooc->block_state[b] != BLOCK_ABSENT)
+        {
+            continue;
+        }
+
+        ooc->block_state[b] = BLOCK_LOADING;
+        pthread_mutex_unlock(&ooc->lock);
+        AdjBlock* block = ooc_read_block(ooc, b);
+        pthread_mutex_lock(&ooc->lock);
+        ooc_insert(ooc, b, block, 1);
+    }
+    pthread_mutex_unlock(&ooc->lock);
+    return(NULL);
+}
+
+void ooc_request(sp_ooc* ooc, const Heap* heap)
+{
+    // Queue read-ahead for the blocks of the states at the top of the heap
+    pthread_mutex_lock(&ooc->lock);
+    int queued = 0;
+    for (int i = 0; i < heap->curr_size && i < OOC_PREFETCH_DEPTH; i++)
+    {
+        int b = (heap->arr[i].vertex / ooc->layers) / ADJ_BLOCK;
+        if (ooc->block_state[b] == BLOCK_ABSENT && ooc->request_count < OOC_QUEUE)
+        {
+            ooc->requests[(ooc->request_head + ooc->request_count) % OOC_QUEUE] = b;
+            ooc->request_count++;
+            queued = 1;
+        }
+    }
+
+    if (queued)
+    {
+        pthread_cond_signal(&ooc->wake);
+    }
+    pthread_mutex_unlock(&ooc->lock);
+}
+
+const AdjBlock* ooc_fetch(sp_ooc* ooc, int b)
+{
+    // Block b, pinned until the next fetch; NULL on I/O errors
+    pthread_mutex_lock(&ooc->lock);
+    while (ooc->block_state[b] == BLOCK_LOADING)
+    {
+        pthread_cond_wait(&ooc->loaded, &ooc->lock); // The prefetcher is already reading it
+    }
+
+    if (ooc->block_state[b] == BLOCK_CACHED)
+    {
+        ooc->io.hits++;
+        ooc->referenced[b] = 1;
+        ooc->pinned = b;
+        AdjBlock* block = ooc->cached[b];
+        pthread_mutex_unlock(&ooc->lock);
+        return(block);
+    }
+
+    ooc->io.misses++;
+    ooc->block_state[b] = BLOCK_LOADING;
+    pthread_mutex_unlock(&ooc->lock);
+
+    AdjBlock* block = ooc_read_block(ooc, b);
+
+    pthread_mutex_lock(&ooc->lock);
+    ooc->pinned = b;
+    ooc_insert(ooc, b, block, 0);
+    pthread_mutex_unlock(&ooc->lock);
+    return(block);
+}
+
+sp_ooc* sp_ooc_open(const char *store_file, size_t cache_bytes, int *status)
+{
+    int result;
+    if (status == NULL)
+    {
+        status = &result;
+    }
+
+    OocHeader header;
+    int fd = open(store_file, O_RDONLY);
+    if (fd == -1 || read_all(fd, &header, sizeof(header), 0) != SP_OK)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        *status = SP_ERR_IO;
+        return(NULL);
+    }
+
+    if (memcmp(header.magic, OOC_MAGIC, sizeof(header.magic)) != 0 || header.V <= 0 || header.N < 1 || header.N > MAX_WEIGHTS)
+    {
+        close(fd);
+        *status = SP_ERR_FORMAT;
+        return(NULL);
+    }
+
+    sp_ooc* ooc = (sp_ooc*)calloc(1, sizeof(sp_ooc));
+    if (ooc == NULL)
+    {
+        close(fd);
+        *status = SP_ERR_MEMORY;
+        return(NULL);
+    }
+
+    ooc->fd = fd;
+    ooc->V = header.V;
+    ooc->N = header.N;
+    ooc->layers = STEP_LAYERS(header.N);
+    ooc->num_blocks = header.num_blocks;
+    ooc->directory = (OocEntry*)malloc((header.num_blocks + 1) * sizeof(OocEntry));
+    ooc->cached = (AdjBlock**)calloc(header.num_blocks + 1, sizeof(AdjBlock*));
+    ooc->block_state = (unsigned char*)calloc(header.num_blocks + 1, 1);
+    ooc->referenced = (unsigned char*)calloc(header.num_blocks + 1, 1);
+    ooc->distance = (int*)malloc(header.V * ooc->layers * sizeof(int));
+    ooc->previous = (int*)malloc(header.V * ooc->layers * sizeof(int));
+    ooc->hops = (int*)malloc(header.V * ooc->layers * sizeof(int));
+    ooc->minheap = build_heap(1024);
+    ooc->cache_budget = cache_bytes;
+    ooc->pinned = -1;
+    *status = SP_OK;
+
+    if (ooc->directory == NULL || ooc->cached == NULL || ooc->block_state == NULL || ooc->referenced == NULL || ooc->distance == NULL || ooc->previous == NULL || ooc->hops == NULL || ooc->minheap == NULL)
+    {
+        *status = SP_ERR_MEMORY;
+    }
+    else if (read_all(fd, ooc->directory, header.num_blocks * sizeof(OocEntry), header.directory_offset) != SP_OK)
+    {
+        *status = SP_ERR_IO;
+    }
+    else if (header.ordered)
+    {
+        ooc->new_to_old = (int*)malloc(header.V * sizeof(int));
+        ooc->old_to_new = (int*)malloc(header.V * sizeof(int));
+        if (ooc->new_to_old == NULL || ooc->old_to_new == NULL)
+        {
+            *status = SP_ERR_MEMORY;
+        }
+        else if (read_all(fd, ooc->new_to_old, header.V * sizeof(int), header.maps_offset) != SP_OK ||
+                 read_all(fd, ooc->old_to_new, header.V * sizeof(int), header.maps_offset + header.V * sizeof(int)) != SP_OK)
+        {
+            *status = SP_ERR_IO;
+        }
+    }
+
+    if (*status == SP_OK)
+    {
+        pthread_mutex_init(&ooc->lock, NULL);
+        pthread_cond_init(&ooc->loaded, NULL);
+        pthread_cond_init(&ooc->wake, NULL);
+        if (pthread_create(&ooc->prefetcher, NULL, ooc_prefetcher, ooc) != 0)
+        {
+            pthread_mutex_destroy(&ooc->lock);
+            pthread_cond_destroy(&ooc->loaded);
+            pthread_cond_destroy(&ooc->wake);
+            *status = SP_ERR_MEMORY;
+        }
+    }
+
+    if (*status != SP_OK)
+    {
+        ooc->stop = -1; // Prefetcher never started
+        sp_ooc_close(ooc);
+        return(NULL);
+    }
+
+    return(ooc);
+}
+
+void sp_ooc_close(sp_ooc *ooc)
+{
+    if (ooc == NULL)
+    {
+        return;
+    }
+
+    if (ooc->stop != -1)
+    {
+        pthread_mutex_lock(&ooc->lock);
+        ooc->stop = 1;
+        pthread_cond_signal(&ooc->wake);
+        pthread_mutex_unlock(&ooc->lock);
+        pthread_join(ooc->prefetcher, NULL);
+        pthread_mutex_destroy(&ooc->lock);
+        pthread_cond_destroy(&ooc->loaded);
+        pthread_cond_destroy(&ooc->wake);
+    }
+
+    for (int b = 0; ooc->cached != NULL && b < ooc->num_blocks; b++)
+    {
+        free(ooc->cached[b]);
+    }
+    if (ooc->minheap != NULL)
+    {
+        free(ooc->minheap->arr);
+        free(ooc->minheap);
+    }
+    free(ooc->directory);
+    free(ooc->cached);
+    free(ooc->block_state);
+    free(ooc->referenced);
+    free(ooc->distance);
+    free(ooc->previous);
+    free(ooc->hops);
+    free(ooc->new_to_old);
+    free(ooc->old_to_new);
+    close(ooc->fd);
+    free(ooc);
+}
+
+static inline int ooc_external_state(const sp_ooc* ooc, int state)
+{
+    // State id under the graph file vertex ids (the tie rule of external_state)
+    int vertex = state / ooc->layers;
+    return(((ooc->new_to_old != NULL) ? ooc->new_to_old[vertex] : vertex) * ooc->layers + state % ooc->layers);
+}
+
+int sp_ooc_path(sp_ooc *ooc, int source, int destination, int *distance, int *path, int capacity, int *length, sp_io_stats *io)
+{
+    // Dijkstra over (vertex, step) states with lazy deletion, on the (distance, hops) labels and
+    // tie rule of search_kernel. The search stops once the frontier passes the first destination
+    // distance, so only blocks of states no farther than the destination are read.
+    if (source < 0 || source >= ooc->V || destination < 0 || destination >= ooc->V)
+    {
+        return(SP_ERR_RANGE);
+    }
+
+    pthread_mutex_lock(&ooc->lock);
+    sp_io_stats before = ooc->io;
+    pthread_mutex_unlock(&ooc->lock);
+
+    int layers = ooc->layers;
+    int n = ooc->N;
+    int src = (ooc->old_to_new != NULL) ? ooc->old_to_new[source] : source;
+    int dest = (ooc->old_to_new != NULL) ? ooc->old_to_new[destination] : destination;
+    for (int i = 0; i < ooc->V * layers; i++)
+    {
+        ooc->distance[i] = INF;
+        ooc->previous[i] = -1;
+        ooc->hops[i] = 0;
+    }
+
+    Heap* minheap = ooc->minheap;
+    minheap->curr_size = 0;
+    ooc->distance[src * layers] = 0;
+    Node start = {src * layers, 0, 0, 0};
+    insert_node(minheap, start); // An empty heap always has room
+
+    int status = SP_OK;
+    int best = INF; // Distance of the destination once one of its states is popped
+    while (minheap->curr_size > 0)
+    {
+        Node minNode = extract_min(minheap);
+        int state = minNode.vertex;
+        if (minNode.distance > best)
+        {
+            break; // Every destination state at the best distance is final
+        }
+        if (minNode.distance != ooc->distance[state] || minNode.hops != ooc->hops[state])
+        {
+            continue; // Stale entry
+        }
+
+        int u = state / layers;
+        if (u == dest && best == INF)
+        {
+            best = minNode.distance; // Later steps may still tie, and paths may pass through
+        }
+
+        ooc_request(ooc, minheap); // Read ahead for what comes next
+        const AdjBlock* block = ooc_fetch(ooc, u / ADJ_BLOCK);
+        if (block == NULL)
+        {
+            status = SP_ERR_IO;
+            break;
+        }
+
+        int curr_step = minNode.step;
+        int weight_ind = curr_step % n;
+        int next_step = (curr_step + 1) % layers;
+        EdgeCursor edges;
+        int v;
+        int weight;
+        for (edges_begin_block(&edges, block, u, 1); edges_next(&edges, weight_ind, &v, &weight, 1); )
+        {
+            int next = v * layers + next_step;
+            int candidate = minNode.distance + weight;
+            int candidate_hops = minNode.hops + 1;
+            if (candidate < ooc->distance[next] || (candidate == ooc->distance[next] && candidate_hops < ooc->hops[next]))
+            {
+                ooc->distance[next] = candidate;
+                ooc->hops[next] = candidate_hops;
+                ooc->previous[next] = state;
+                Node node = {next, candidate, next_step, candidate_hops};
+                if (insert_node(minheap, node) != SP_OK)
+                {
+                    status = SP_ERR_MEMORY;
+                    break;
+                }
+            }
+            else if (candidate == ooc->distance[next] && candidate_hops == ooc->hops[next] &&
+                     ooc_external_state(ooc, state) < ooc_external_state(ooc, ooc->previous[next]))
+            {
+                ooc->previous[next] = state; // Same label, smaller predecessor
+            }
+        }
+
+        if (status != SP_OK)
+        {
+            break;
+        }
+    }
+
+    // Lowest step at the best distance, as best_step picks it
+    int found = -1;
+    for (int step = 0; step < layers && best != INF && found == -1; step++)
+    {
+        found = (ooc->distance[dest * layers + step] == best) ? dest * layers + step : -1;
+    }
+
+    *distance = INF;
+    *length = 0;
+    if (found != -1)
+    {
+        *distance = ooc->distance[found];
+        for (int current_node = found; current_node != -1; current_node = ooc->previous[current_node])
+        {
+            (*length)++;
+        }
+
+        if (*length > capacity)
+        {
+            status = (status == SP_OK) ? SP_ERR_BUFFER : status;
+        }
+        else
+        {
+            int path_index = *length;
+            for (int current_node = found; current_node != -1; current_node = ooc->previous[current_node])
+            {
+                int vertex = current_node / layers;
+                path[--path_index] = (ooc->new_to_old != NULL) ? ooc->new_to_old[vertex] : vertex;
+            }
+        }
+    }
+
+    if (io != NULL)
+    {
+        // I/O done on behalf of this query (including read-ahead it triggered)
+        pthread_mutex_lock(&ooc->lock);
+        io->bytes_read = ooc->io.bytes_read - before.bytes_read;
+        io->reads = ooc->io.reads - before.reads;
+        io->prefetched = ooc->io.prefetched - before.prefetched;
+        io->hits = ooc->io.hits - before.hits;
+        io->misses = ooc->io.misses - before.misses;
+        pthread_mutex_unlock(&ooc->lock);
+    }
+
+    return(status);
+}
+
+#define SHARD_MAILBOX 4096 // Messages per (sender, receiver) pair and round (at least the largest out-degree)
+
+typedef struct
+{
+    int state; // Receiver-owned state
+    int distance; // Proposed distance
+    int hops; // Proposed hops (ties between equal distances, as in search_kernel)
+    int previous; // Predecessor state on the sender side
+} ShardMessage;
+
+// Shared between the coordinator and the workers (one anonymous shared mapping)
+typedef struct
+{
+    pthread_barrier_t round_barrier; // Workers only: bucket and exchange rounds
+    int source; // Internal id
+    int destination; // Internal id
+    int frontier[SP_MAX_SHARDS]; // Smallest queued distance of each shard
+    int dest_best[SP_MAX_SHARDS]; // Best destination distance (owner shard only, INF elsewhere)
+    int active[SP_MAX_SHARDS]; // Shard still has work in the current bucket
+    int mail_count[SP_MAX_SHARDS][SP_MAX_SHARDS]; // Messages posted [from][to] this round
+} ShardControl;
+
+// Owned states waiting to be expanded: a binary heap (node_less order) with the position of every
+// state, so an improved label moves its entry instead of adding one and the size is bounded
+typedef struct
+{
+    Node *arr; // Heap of queued owned states
+    int *pos; // Heap index of owned state first + i (-1 if not queued)
+    int size; // Queued states
+    int first; // First owned state
+} ShardQueue;
+
+// Memory of one worker. Allocated by sp_shards_start before forking, so a worker never calls
+// malloc (the host may have had another thread inside malloc at the fork)
+typedef struct
+{
+    sp_shards *set; // Shared mapping and partition
+    int me; // This shard
+    int layers; // Step layers per vertex
+    ShardQueue queue; // Owned states to expand
+    int *touched; // Owned states labelled this query, reset before the next one
+    int touched_count;
+} ShardWorker;
+
+struct sp_shards
+{
+    Data *data; // Version the workers were forked with
+    int shards; // Number of worker processes
+    pid_t pids[SP_MAX_SHARDS]; // Workers
+    int channels[SP_MAX_SHARDS]; // Coordinator end of each worker's socket (start and done bytes; EOF if it died)
+    int broken; // A worker died: the others were killed and every query fails
+    ShardWorker workers[SP_MAX_SHARDS]; // Worker memory (each child uses its own entry)
+    int *owner; // Shard owning each adjacency block
+    int delta; // Bucket width of the search
+    int mailbox_capacity; // Messages per mailbox
+    void *shared; // The mapping below
+    size_t shared_bytes;
+    ShardControl *control;
+    int *distance; // Distance of every state (written by the owning shard)
+    int *previous; // Predecessor of every state (written by the owning shard)
+    int *hops; // Edges on the path to every state (written by the owning shard)
+    ShardMessage *mailboxes; // [from][to][mailbox_capacity]
+    sp_shards *next; // Next live set in shard_registry
+};
+
+// Every live set of the process. A forked worker closes the coordinator channels of all of them,
+// or a set's workers would not see EOF when sp_shards_stop closes its channels while a worker of
+// another set still holds a copy. The lock is held from socketpair until the channel is recorded
+// and while channels are closed, so no worker is forked with a channel that is not listed.
+static pthread_mutex_t shard_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static sp_shards *shard_registry = NULL;
+
+static inline ShardMessage* shard_mailbox(const sp_shards* set, int from, int to)
+{
+    return(set->mailboxes + ((size_t)from * set->shards + to) * set->mailbox_capacity);
+}
+
+void shard_queue_swap(ShardQueue* queue, int a, int b)
+{
+    Node temp = queue->arr[a];
+    queue->arr[a] = queue->arr[b];
+    queue->arr[b] = temp;
+    queue->pos[queue->arr[a].vertex - queue->first] = a;
+    queue->pos[queue->arr[b].vertex - queue->first] = b;
+}
+
+void shard_queue_push(ShardQueue* queue, Node node)
+{
+    // Queue an owned state, or move it up if it is queued already (labels only improve)
+    int ind = queue->pos[node.vertex - queue->first];
+    if (ind == -1)
+    {
+        ind = (queue->size)++;
+        queue->pos[node.vertex - queue->first] = ind;
+    }
+    queue->arr[ind] = node;
+
+    while (ind > 0 && node_less(&queue->arr[ind], &queue->arr[(ind - 1) / 2]))
+    {
+        shard_queue_swap(queue, ind, (ind - 1) / 2);
+        ind = (ind - 1) / 2;
+    }
+}
+
+Node shard_queue_pop(ShardQueue* queue)
+{
+    Node root = queue->arr[0];
+    queue->pos[root.vertex - queue->first] = -1;
+    (queue->size)--;
+    if (queue->size > 0)
+    {
+        queue->arr[0] = queue->arr[queue->size];
+        queue->pos[queue->arr[0].vertex - queue->first] = 0;
+        int ind = 0;
+        for (;;)
+        {
+            int min = ind;
+            int left_child = (ind * 2) + 1;
+            int right_child = (ind * 2) + 2;
+            if (left_child < queue->size && node_less(&queue->arr[left_child], &queue->arr[min]))
+            {
+                min = left_child;
+            }
+            if (right_child < queue->size && node_less(&queue->arr[right_child], &queue->arr[min]))
+            {
+                min = right_child;
+            }
+            if (min == ind)
+            {
+                break;
+            }
+            shard_queue_swap(queue, ind, min);
+            ind = min;
+        }
+    }
+
+    return(root);
+}
+
+void shard_relax(ShardWorker* w, int state, int distance, int hops, int previous)
+{
+    // Offer an owned state the label (distance, hops) through previous. Same rule as search_kernel:
+    // labels compare lexicographically and an equal label goes to the predecessor with the smallest
+    // graph file state id. Converged labels are unique and every tight predecessor offers its label
+    // at some point, so the tree is the serial one whatever order the offers arrive in.
+    sp_shards* set = w->set;
+    int current = set->distance[state];
+    if (distance > current || (distance == current && hops > set->hops[state]))
+    {
+        return;
+    }
+
+    if (distance == current && hops == set->hops[state])
+    {
+        if (external_state(set->data, previous, w->layers) < external_state(set->data, set->previous[state], w->layers))
+        {
+            set->previous[state] = previous; // Same label, smaller predecessor
+        }
+        return;
+    }
+
+    if (current == INF) // First label this query: remember it for the reset (at most once per owned state)
+    {
+        w->touched[(w->touched_count)++] = state;
+    }
+
+    // A better label: its successors may improve too
+    set->distance[state] = distance;
+    set->hops[state] = hops;
+    set->previous[state] = previous;
+    Node node = {state, distance, state % w->layers, hops};
+    shard_queue_push(&w->queue, node);
+}
+
+int shard_expand(ShardWorker* w, long long limit)
+{
+    // Expand owned states closer than limit, posting improvements for other shards straight into
+    // this round's mailboxes. Returns 1 if it stopped because a state's edges might not fit.
+    sp_shards* set = w->set;
+    const Data* data = set->data;
+    ShardControl* control = set->control;
+    ShardQueue* queue = &w->queue;
+    int layers = w->layers;
+    int fullest = 0; // Largest mail count this round
+
+    for (int s = 0; s < set->shards; s++)
+    {
+        control->mail_count[w->me][s] = 0; // Read by the receivers before the last barrier
+    }
+
+    while (queue->size > 0 && queue->arr[0].distance < limit)
+    {
+        int state = queue->arr[0].vertex;
+        int u = state / layers;
+        const AdjBlock* block = data->blocks[u / ADJ_BLOCK];
+        int degree = block->start[u % ADJ_BLOCK + 1] - block->start[u % ADJ_BLOCK];
+        if (fullest + degree > set->mailbox_capacity)
+        {
+            return(1); // Next exchange (an empty mailbox holds any vertex's edges)
+        }
+
+        Node minNode = shard_queue_pop(queue);
+        int weight_ind = minNode.step % data->N;
+        int next_step = (minNode.step + 1) % layers;
+        EdgeCursor edges;
+        int v;
+        int weight;
+        for (edges_begin(&edges, data, u, data->packed); edges_next(&edges, weight_ind, &v, &weight, data->packed); )
+        {
+            int owner = set->owner[v / ADJ_BLOCK];
+            if (owner == w->me)
+            {
+                shard_relax(w, v * layers + next_step, minNode.distance + weight, minNode.hops + 1, state);
+            }
+            else
+            {
+                int count = (control->mail_count[w->me][owner])++;
+                ShardMessage message = {v * layers + next_step, minNode.distance + weight, minNode.hops + 1, state};
+                shard_mailbox(set, w->me, owner)[count] = message;
+                fullest = (count + 1 > fullest) ? count + 1 : fullest;
+            }
+        }
+    }
+
+    return(0);
+}
+
+void shard_search(ShardWorker* w)
+{
+    // Delta-stepping over the owned states. Each round the shards agree on the smallest queued
+    // distance m, then expand every state closer than the end of m's bucket, exchanging
+    // improvements until no shard has work left in it. The search stops once m exceeds the best
+    // destination distance: every state at or below it then has its final (distance, hops) label
+    // and predecessor, so the step choice and the path match sp_query_path.
+    sp_shards* set = w->set;
+    ShardControl* control = set->control;
+    ShardQueue* queue = &w->queue;
+    int layers = w->layers;
+    int me = w->me;
+
+    for (int i = 0; i < w->touched_count; i++)
+    {
+        int state = w->touched[i];
+        set->distance[state] = INF;
+        set->previous[state] = -1;
+        set->hops[state] = 0;
+        queue->pos[state - queue->first] = -1;
+    }
+    w->touched_count = 0;
+    queue->size = 0;
+
+    int dest = control->destination;
+    int dest_owner = set->owner[dest / ADJ_BLOCK];
+    if (set->owner[control->source / ADJ_BLOCK] == me)
+    {
+        shard_relax(w, control->source * layers, 0, 0, -1);
+    }
+
+    for (;;)
+    {
+        control->frontier[me] = (queue->size > 0) ? queue->arr[0].distance : INF;
+        control->dest_best[me] = INF;
+        if (dest_owner == me)
+        {
+            int step = best_step(set->distance, 1, 0, dest, layers);
+            control->dest_best[me] = (step == -1) ? INF : set->distance[dest * layers + step];
+        }
+        pthread_barrier_wait(&control->round_barrier);
+
+        int m = INF;
+        int best = INF;
+        for (int s = 0; s < set->shards; s++)
+        {
+            m = (control->frontier[s] < m) ? control->frontier[s] : m;
+            best = (control->dest_best[s] < best) ? control->dest_best[s] : best;
+        }
+        if (m == INF || m > best)
+        {
+            return; // Same decision in every shard
+        }
+
+        long long limit = ((long long)m / set->delta + 1) * set->delta; // End of m's bucket
+        for (;;)
+        {
+            int pending = shard_expand(w, limit);
+            pthread_barrier_wait(&control->round_barrier);
+
+            for (int s = 0; s < set->shards; s++)
+            {
+                const ShardMessage* mailbox = shard_mailbox(set, s, me);
+                for (int i = 0; i < control->mail_count[s][me]; i++)
+                {
+                    shard_relax(w, mailbox[i].state, mailbox[i].distance, mailbox[i].hops, mailbox[i].previous);
+                }
+            }
+            control->active[me] = pending || (queue->size > 0 && queue->arr[0].distance < limit);
+            pthread_barrier_wait(&control->round_barrier);
+
+            int active = 0;
+            for (int s = 0; s < set->shards; s++)
+            {
+                active |= control->active[s];
+            }
+            if (!active)
+            {
+                break;
+            }
+        }
+    }
+}
+
+void shard_worker(ShardWorker* w, int channel)
+{
+    // Worker process: answers a query for every byte the coordinator sends, until the coordinator
+    // closes its end. Only system calls and memory allocated before the fork from here on.
+    char byte;
+    for (;;)
+    {
+        ssize_t got = read(channel, &byte, 1);
+        if (got == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got != 1)
+        {
+            return; // sp_shards_stop (or the coordinator is gone)
+        }
+
+        shard_search(w);
+        if (send(channel, &byte, 1, MSG_NOSIGNAL) != 1)
+        {
+            return;
+        }
+    }
+}
+
+void shard_unregister(sp_shards* set)
+{
+    pthread_mutex_lock(&shard_registry_lock);
+    for (sp_shards **link = &shard_registry; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == set)
+        {
+            *link = set->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&shard_registry_lock);
+}
+
+void shard_kill(sp_shards* set)
+{
+    // A worker died, so the others may wait at round_barrier forever: end them all
+    for (int s = 0; s < set->shards; s++)
+    {
+        if (set->pids[s] > 0)
+        {
+            kill(set->pids[s], SIGKILL);
+            waitpid(set->pids[s], NULL, 0);
+            set->pids[s] = 0;
+        }
+    }
+
+    pthread_mutex_lock(&shard_registry_lock); // A worker forked meanwhile must not close a reused descriptor
+    for (int s = 0; s < set->shards; s++)
+    {
+        if (set->channels[s] != -1)
+        {
+            close(set->channels[s]);
+            set->channels[s] = -1;
+        }
+    }
+    pthread_mutex_unlock(&shard_registry_lock);
+    set->broken = 1;
+}
+
+int shard_round_trip(sp_shards* set)
+{
+    // Start the posted query on every worker and wait until all of them are done. EOF or an error
+    // on a channel means its worker died: SP_ERR_WORKER, and the set is broken from then on.
+    char byte = 'q';
+    int status = SP_OK;
+    for (int s = 0; s < set->shards && status == SP_OK; s++)
+    {
+        if (send(set->channels[s], &byte, 1, MSG_NOSIGNAL) != 1)
+        {
+            status = SP_ERR_WORKER;
+        }
+    }
+
+    int done[SP_MAX_SHARDS] = {0};
+    int remaining = set->shards;
+    while (status == SP_OK && remaining > 0)
+    {
+        struct pollfd fds[SP_MAX_SHARDS];
+        for (int s = 0; s < set->shards; s++)
+        {
+            fds[s].fd = done[s] ? -1 : set->channels[s]; // Negative descriptors are ignored
+            fds[s].events = POLLIN;
+            fds[s].revents = 0;
+        }
+
+        if (poll(fds, set->shards, -1) == -1)
+        {
+            status = (errno == EINTR) ? SP_OK : SP_ERR_WORKER;
+            continue;
+        }
+
+        for (int s = 0; s < set->shards && status == SP_OK; s++)
+        {
+            if (fds[s].revents == 0)
+            {
+                continue;
+            }
+
+            ssize_t got = read(set->channels[s], &byte, 1);
+            if (got == 1)
+            {
+                done[s] = 1;
+                remaining--;
+            }
+            else if (got == 0 || errno != EINTR)
+            {
+                status = SP_ERR_WORKER;
+            }
+        }
+    }
+
+    if (status != SP_OK)
+    {
+        shard_kill(set);
+    }
+    return(status);
+}
+
+void shard_free(sp_shards* set)
+{
+    // Everything but the workers themselves
+    shard_unregister(set);
+    for (int s = 0; s < set->shards; s++)
+    {
+        free(set->workers[s].queue.arr);
+        free(set->workers[s].queue.pos);
+        free(set->workers[s].touched);
+    }
+    if (set->shared != NULL)
+    {
+        if (!set->broken)
+        {
+            pthread_barrier_destroy(&set->control->round_barrier); // Waits for waiters, and killed workers never leave
+        }
+        munmap(set->shared, set->shared_bytes);
+    }
+    free(set->owner);
+    graph_release(set->data);
+    free(set);
+}
+
+sp_shards* sp_shards_start(sp_graph *graph, int shards, int *status)
+{
+    int result;
+    if (status == NULL)
+    {
+        status = &result;
+    }
+
+    if (shards < 1 || shards > SP_MAX_SHARDS)
+    {
+        *status = SP_ERR_RANGE;
+        return(NULL);
+    }
+
+    sp_shards* set = (sp_shards*)calloc(1, sizeof(sp_shards));
+    if (set == NULL)
+    {
+        *status = SP_ERR_MEMORY;
+        return(NULL);
+    }
+
+    Data* data = graph_acquire(&graph->store); // Held until sp_shards_stop
+    set->data = data;
+    set->shards = shards;
+    for (int s = 0; s < SP_MAX_SHARDS; s++)
+    {
+        set->channels[s] = -1;
+    }
+    set->owner = (int*)malloc(data->num_blocks * sizeof(int));
+    if (set->owner == NULL)
+    {
+        shard_free(set);
+        *status = SP_ERR_MEMORY;
+        return(NULL);
+    }
+
+    // Contiguous block ranges with about the same number of edges (reordered graphs keep
+    // neighbours in nearby blocks, so fewer edges cross shards)
+    long long seen = 0;
+    long long weight_sum = 0;
+    for (int b = 0; b < data->num_blocks; b++)
+    {
+        int owner = (int)((seen * shards) / (data->edge_num + 1));
+        set->owner[b] = (owner < shards) ? owner : shards - 1;
+        seen += data->blocks[b]->edge_num;
+    }
+
+    // Bucket width: the mean edge weight, so a bucket is about one hop of the frontier
+    int max_degree = 0;
+    for (int u = 0; u < data->V; u++)
+    {
+        EdgeCursor edges;
+        int v;
+        int weight;
+        for (int j = 0; j < data->N; j++)
+        {
+            for (edges_begin(&edges, data, u, data->packed); edges_next(&edges, j, &v, &weight, data->packed); )
+            {
+                weight_sum += weight;
+            }
+        }
+
+        const AdjBlock* block = data->blocks[u / ADJ_BLOCK];
+        int degree = block->start[u % ADJ_BLOCK + 1] - block->start[u % ADJ_BLOCK];
+        max_degree = (degree > max_degree) ? degree : max_degree;
+    }
+    set->delta = (data->edge_num > 0) ? (int)(weight_sum / ((long long)data->edge_num * data->N)) : 1;
+    set->delta = (set->delta > 0) ? set->delta : 1;
+    set->mailbox_capacity = (max_degree > SHARD_MAILBOX) ? max_degree : SHARD_MAILBOX;
+
+    // Worker memory: each shard's states are one contiguous range
+    int layers = STEP_LAYERS(data->N);
+    for (int s = 0; s < shards; s++)
+    {
+        int first_block = 0;
+        while (first_block < data->num_blocks && set->owner[first_block] < s)
+        {
+            first_block++;
+        }
+        int last_block = first_block;
+        while (last_block < data->num_blocks && set->owner[last_block] == s)
+        {
+            last_block++;
+        }
+        int first = (first_block * ADJ_BLOCK < data->V) ? first_block * ADJ_BLOCK : data->V;
+        int last = (last_block * ADJ_BLOCK < data->V) ? last_block * ADJ_BLOCK : data->V;
+        size_t owned = (size_t)(last - first) * layers;
+
+        ShardWorker* w = &set->workers[s];
+        w->set = set;
+        w->me = s;
+        w->layers = layers;
+        w->queue.first = first * layers;
+        w->queue.arr = (Node*)malloc((owned + 1) * sizeof(Node));
+        w->queue.pos = (int*)malloc((owned + 1) * sizeof(int));
+        w->touched = (int*)malloc((owned + 1) * sizeof(int));
+        if (w->queue.arr == NULL || w->queue.pos == NULL || w->touched == NULL)
+        {
+            shard_free(set);
+            *status = SP_ERR_MEMORY;
+            return(NULL);
+        }
+        for (size_t i = 0; i < owned; i++)
+        {
+            w->queue.pos[i] = -1;
+        }
+    }
+
+    size_t states = (size_t)data->V * layers;
+    size_t control_bytes = (sizeof(ShardControl) + 63) & ~(size_t)63;
+    size_t shared_bytes = control_bytes + 3 * states * sizeof(int) + (size_t)shards * shards * set->mailbox_capacity * sizeof(ShardMessage);
+    int zero = open("/dev/zero", O_RDWR); // Shared anonymous memory without leaving POSIX
+    void *shared = (zero == -1) ? MAP_FAILED : mmap(NULL, shared_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, zero, 0);
+    if (zero != -1)
+    {
+        close(zero);
+    }
+    if (shared == MAP_FAILED)
+    {
+        shard_free(set);
+        *status = SP_ERR_MEMORY;
+        return(NULL);
+    }
+
+    set->shared = shared;
+    set->shared_bytes = shared_bytes;
+    set->control = (ShardControl*)set->shared;
+    set->distance = (int*)((char*)set->shared + control_bytes);
+    set->previous = set->distance + states;
+    set->hops = set->previous + states;
+    set->mailboxes = (ShardMessage*)(set->hops + states);
+    for (size_t i = 0; i < states; i++)
+    {
+        set->distance[i] = INF;
+        set->previous[i] = -1; // hops start at 0 (/dev/zero)
+    }
+
+    pthread_barrierattr_t attr;
+    pthread_barrierattr_init(&attr);
+    pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(&set->control->round_barrier, &attr, shards);
+    pthread_barrierattr_destroy(&attr);
+
+    pthread_mutex_lock(&shard_registry_lock);
+    set->next = shard_registry;
+    shard_registry = set;
+    pthread_mutex_unlock(&shard_registry_lock);
+
+    for (int s = 0; s < shards; s++)
+    {
+        int pair[2];
+        pid_t pid = -1;
+        pthread_mutex_lock(&shard_registry_lock);
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0)
+        {
+            fcntl(pair[0], F_SETFD, FD_CLOEXEC); // Not inherited by programs the host runs
+            fcntl(pair[1], F_SETFD, FD_CLOEXEC);
+            pid = fork();
+            if (pid == 0)
+            {
+                // Keep only this worker's end, so every worker of every set sees EOF when its
+                // coordinator closes (the registry is consistent: the fork happened under its lock)
+                for (sp_shards* other = shard_registry; other != NULL; other = other->next)
+                {
+                    for (int i = 0; i < other->shards; i++)
+                    {
+                        if (other->channels[i] != -1)
+                        {
+                            close(other->channels[i]);
+                        }
+                    }
+                }
+                close(pair[0]);
+                shard_worker(&set->workers[s], pair[1]); // Only ever reads its own blocks of the inherited version
+                _exit(EXIT_SUCCESS);
+            }
+            close(pair[1]);
+            if (pid == -1)
+            {
+                close(pair[0]);
+            }
+            else
+            {
+                set->pids[s] = pid;
+                set->channels[s] = pair[0];
+            }
+        }
+        pthread_mutex_unlock(&shard_registry_lock);
+
+        if (pid == -1)
+        {
+            shard_kill(set); // Workers already running
+            shard_free(set);
+            *status = SP_ERR_MEMORY;
+            return(NULL);
+        }
+    }
+
+    *status = SP_OK;
+    return(set);
+}
+
+void sp_shards_stop(sp_shards *shards)
+{
+    if (shards == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&shard_registry_lock); // Not while another set forks a worker that must close them
+    for (int s = 0; s < shards->shards; s++)
+    {
+        if (shards->channels[s] != -1)
+        {
+            close(shards->channels[s]); // The worker reads EOF and exits
+            shards->channels[s] = -1;
+        }
+    }
+    pthread_mutex_unlock(&shard_registry_lock);
+    for (int s = 0; s < shards->shards; s++)
+    {
+        if (shards->pids[s] > 0)
+        {
+            waitpid(shards->pids[s], NULL, 0);
+        }
+    }
+
+    shard_free(shards);
+}
+
+int sp_shards_path(sp_shards *shards, int source, int destination, int *distance, int *path, int capacity, int *length)
+{
+    const Data* data = shards->data;
+    if (shards->broken)
+    {
+        return(SP_ERR_WORKER);
+    }
+    if (source < 0 || source >= data->V || destination < 0 || destination >= data->V)
+    {
+        return(SP_ERR_RANGE);
+    }
+
+    int dest = internal_id(data, destination);
+    shards->control->source = internal_id(data, source);
+    shards->control->destination = dest;
+    int status = shard_round_trip(shards);
+    if (status != SP_OK)
+    {
+        return(status);
+    }
+
+    int layers = STEP_LAYERS(data->N);
+    int step = best_step(shards->distance, 1, 0, dest, layers);
+
+    *distance = INF;
+    *length = 0;
+    if (step != -1)
+    {
+        *distance = shards->distance[dest * layers + step];
+        *length = write_path(data, shards->previous, 1, 0, dest * layers + step, path, capacity);
+        status = (*length > capacity) ? SP_ERR_BUFFER : SP_OK;
+    }
+
+    return(status);
+}
@@ -0,0 +1,163 @@
+#ifndef SHORTESTPATHS_H
+#define SHORTESTPATHS_H
+
+// libshortestpaths: shortest paths in graphs whose edge weights change with the step count.
+// The k-th edge of a path (k = 0, 1, ...) costs weights[k % N]. All vertex ids in this API
+// are the ids used in the graph file, whatever internal ordering was chosen at load time.
+//
+// A graph may be queried from many threads at once (one sp_query per thread) while other
+// threads apply edge updates; queries never wait for writers.
+
+#include <stddef.h>
+#include <limits.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SP_API_VERSION 1
+
+#if defined(__GNUC__)
+#define SP_API __attribute__((visibility("default")))
+#else
+#define SP_API
+#endif
+
+#define SP_INF INT_MAX // Distance reported for unreachable vertices
+#define SP_MAX_WEIGHTS 10 // Largest supported N
+
+// A path never has more than V * SP_MAX_WEIGHTS vertices
+#define SP_MAX_PATH(V) ((V) * SP_MAX_WEIGHTS)
+
+// Load-time vertex orderings (internal relabeling for cache locality)
+#define SP_ORDER_NONE 0 // Keep the ids from the graph file
+#define SP_ORDER_BFS 1 // Breadth-first discovery order
+#define SP_ORDER_RCM 2 // Reverse Cuthill-McKee
+#define SP_ORDER_DEGREE 3 // Hub-first (highest degree first)
+#define SP_ORDER_MASK 0xff
+
+// Load flags, or'ed with the ordering
+#define SP_COMPRESS 0x100 // Varint target deltas and bit-packed weights, decoded during the search
+
+// Status codes
+#define SP_OK 0
+#define SP_ERR_RANGE -1 // Vertex id out of range
+#define SP_ERR_NOT_FOUND -2 // No such edge
+#define SP_ERR_BUFFER -3 // Caller buffer too small (the required size is still reported)
+#define SP_ERR_IO -4 // Graph file could not be read
+#define SP_ERR_FORMAT -5 // Malformed graph (bad header or N out of 1 .. SP_MAX_WEIGHTS)
+#define SP_ERR_MEMORY -6 // Out of memory
+#define SP_ERR_UNSUPPORTED -7 // Option not available for this operation
+#define SP_ERR_WORKER -8 // A shard worker process died (the sp_shards can only be stopped)
+
+typedef struct sp_graph sp_graph; // Loaded graph, shared by all threads
+typedef struct sp_query sp_query; // Per-thread query context (scratch memory is reused across queries)
+typedef struct sp_ooc sp_ooc; // Out-of-core graph (adjacency stays on disk)
+typedef struct sp_shards sp_shards; // Worker processes sharing the search of one graph version
+
+typedef struct
+{
+    long long bytes_read; // Bytes read from the store file
+    long reads; // Blocks read
+    long prefetched; // Blocks read ahead by the prefetch thread (part of reads)
+    long hits; // Block lookups served from the cache
+    long misses; // Block lookups that had to read synchronously
+} sp_io_stats;
+
+// Graph text format: "V N" followed by "vs vt w0 .. w(N-1)" per edge, whitespace separated.
+// sp_graph_load maps the file and parses it in place; sp_graph_load_buffer parses caller memory.
+// options is an SP_ORDER_* value, optionally | SP_COMPRESS. Both return NULL on failure and
+// store the reason in *status when status is not NULL.
+SP_API sp_graph* sp_graph_load(const char *filename, int options, int *status);
+SP_API sp_graph* sp_graph_load_buffer(const char *text, size_t length, int options, int *status);
+
+// No queries may be running when the graph is freed
+SP_API void sp_graph_free(sp_graph *graph);
+
+SP_API int sp_graph_vertices(const sp_graph *graph);
+SP_API int sp_graph_weights(const sp_graph *graph);
+SP_API long sp_graph_version(sp_graph *graph); // Number of updates applied since loading
+SP_API size_t sp_graph_adjacency_bytes(sp_graph *graph); // Memory used by the adjacency
+
+// Copies up to capacity outgoing edges of vertex (targets[i] and weights[i * N .. i * N + N - 1]).
+// Returns the number of outgoing edges, or a negative status.
+SP_API int sp_graph_out_edges(sp_graph *graph, int vertex, int *targets, int *weights, int capacity);
+
+// Edge updates. Each publishes a new graph version; queries already running keep the old one.
+SP_API int sp_graph_set_edge(sp_graph *graph, int vs, int vt, const int *weights); // Adds the edge if missing
+SP_API int sp_graph_remove_edge(sp_graph *graph, int vs, int vt);
+
+SP_API sp_query* sp_query_create(sp_graph *graph);
+SP_API void sp_query_free(sp_query *query);
+
+// Point to point. *distance is SP_INF and *length 0 if destination is unreachable.
+// path (capacity entries, may be NULL if capacity is 0) receives the vertices, source first.
+// Among equal-distance paths the one with the fewest edges wins, then the one whose predecessors
+// have the smallest graph file ids, so the path does not depend on the load-time ordering.
+// The destination is reached at its lowest step with the minimum distance.
+SP_API int sp_query_path(sp_query *query, int source, int destination, int *distance, int *path, int capacity, int *length);
+
+// One to many: distances[i] is the shortest distance to targets[i] (SP_INF if unreachable),
+// all from a single search.
+SP_API int sp_query_one_to_many(sp_query *query, int source, const int *targets, int count, int *distances);
+
+// All start phases: like sp_query_path, but for the source starting at step p = 0 .. N - 1, with
+// the same tie rule (phase 0 is exactly the sp_query_path path). distances and lengths have N
+// entries; path p is written at paths + p * capacity.
+SP_API int sp_query_profile(sp_query *query, int source, int destination, int *distances, int *paths, int capacity, int *lengths);
+
+// Range query (isochrone): every vertex reachable from source (starting at step 0) with a
+// distance of at most budget, at any step. Vertex i of the result is vertices[i], with its best
+// distance distances[i] and the step phase steps[i] it is reached at, i.e. the index (0 .. N - 1)
+// of the weight the next edge from it uses; vertices come in order of increasing distance.
+// *count is the number of reachable vertices (SP_ERR_BUFFER if it exceeds capacity; the first
+// capacity are written). The work grows with the isochrone, not the graph.
+SP_API int sp_query_range(sp_query *query, int source, int budget, int *vertices, int *distances, int *steps, int capacity, int *count);
+
+// k shortest alternatives: the k shortest paths from source (starting at step 0) to destination,
+// shortest first, the first being the sp_query_path one cut at its first visit to destination.
+// Paths are loopless in (vertex, step) states, so a path may pass a vertex again at a different
+// step, and each ends at its first visit to destination. Path p is written at
+// paths + p * capacity with distances[p] and lengths[p] (k entries each); *count is the number
+// found (fewer than k if no more exist). The spur searches of each round run on up to
+// sp_query_set_threads threads; the result does not depend on the thread count.
+SP_API int sp_query_k_paths(sp_query *query, int source, int destination, int k, int *distances, int *paths, int capacity, int *lengths, int *count);
+
+// Threads a query may use (sp_query_k_paths): 0 for one per online CPU (the default, at most
+// SP_MAX_THREADS), or 1 .. SP_MAX_THREADS to force that many whatever the CPU count.
+#define SP_MAX_THREADS 8
+SP_API int sp_query_set_threads(sp_query *query, int threads);
+
+// Out-of-core mode for graphs larger than memory. sp_ooc_build streams a graph text file into
+// a store file of page-aligned compressed blocks (order: SP_ORDER_NONE or SP_ORDER_DEGREE).
+// sp_ooc_open keeps at most cache_bytes of blocks resident and reads ahead the blocks the
+// search is about to need; only the per-state distance/predecessor arrays stay in memory.
+// sp_ooc_path works exactly like sp_query_path (same distance and path) and, if io is not NULL,
+// reports the query's I/O.
+// One query at a time per sp_ooc.
+SP_API int sp_ooc_build(const char *graph_file, const char *store_file, int order);
+SP_API sp_ooc* sp_ooc_open(const char *store_file, size_t cache_bytes, int *status);
+SP_API void sp_ooc_close(sp_ooc *ooc);
+SP_API int sp_ooc_path(sp_ooc *ooc, int source, int destination, int *distance, int *path, int capacity, int *length, sp_io_stats *io);
+
+// Sharded execution. sp_shards_start forks shards worker processes (1 .. SP_MAX_SHARDS), each
+// owning a contiguous range of vertices (balanced by edge count) of the graph's current version;
+// later updates to the graph are not seen by the shards. A query runs as a bucketed
+// (delta-stepping) search in which every shard only expands its own states and sends
+// improvements for other shards' states through shared-memory mailboxes. sp_shards_path works
+// exactly like sp_query_path (same distance, step and path). One query at a time per sp_shards.
+// Workers allocate all their memory before the fork. If one dies, sp_shards_path returns
+// SP_ERR_WORKER and kills the others; the sp_shards can then only be stopped.
+// Memory is not partitioned: every worker inherits the whole graph version (copy-on-write, only
+// read) and the labels of all states sit in one shared mapping. Sharding only splits the search
+// work, so it can only help with more than one CPU (pa3 --bench-shards=MAX measures it).
+#define SP_MAX_SHARDS 32
+SP_API sp_shards* sp_shards_start(sp_graph *graph, int shards, int *status);
+SP_API void sp_shards_stop(sp_shards *shards);
+SP_API int sp_shards_path(sp_shards *shards, int source, int destination, int *distance, int *path, int capacity, int *length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,745 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "shortestpaths.h"
+
+// Regression checks for libshortestpaths (make test). The graphs are small and random, with
+// weights in 0 .. 4 so that equal-cost paths are everywhere: that is where two code paths that
+// "compute the same thing" tend to disagree.
+
+#define TEST_V 40 // Vertices per random graph
+#define TEST_EDGES 160 // Edges per random graph
+#define TEST_MAX_WEIGHT 4 // Weights are 0 .. TEST_MAX_WEIGHT
+#define TEST_QUERIES 100 // Queries per graph
+#define TEST_PROFILE_SOURCES 10 // Sources per graph of the profile check (every destination each)
+#define TEST_SHARD_V 256 // Vertices of the sharded graphs (four adjacency blocks)
+#define TEST_SHARD_EDGES 1024 // Edges of the sharded graphs
+#define TEST_K_V 10 // Vertices of the k-paths graphs (small enough to enumerate paths)
+#define TEST_K_EDGES 30 // Edges of the k-paths graphs
+#define TEST_K 8 // Paths per k-paths query
+#define TEST_K_STATES (TEST_K_V * SP_MAX_WEIGHTS)
+
+int failures = 0;
+
+void fail(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "FAIL ");
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    failures++;
+}
+
+char* random_graph(unsigned int seed, int V, int N, int edges, size_t *length)
+{
+    // Graph text in the sp_graph_load format
+    size_t capacity = 32 + (size_t)edges * (24 + 4 * N);
+    char *text = (char*)malloc(capacity);
+    size_t used = snprintf(text, capacity, "%d %d\n", V, N);
+    for (int i = 0; i < edges; i++)
+    {
+        used += snprintf(text + used, capacity - used, "%d %d", rand_r(&seed) % V, rand_r(&seed) % V);
+        for (int j = 0; j < N; j++)
+        {
+            used += snprintf(text + used, capacity - used, " %d", rand_r(&seed) % (TEST_MAX_WEIGHT + 1));
+        }
+        used += snprintf(text + used, capacity - used, "\n");
+    }
+
+    *length = used;
+    return(text);
+}
+
+sp_graph* load_graph(unsigned int seed, int V, int edges, int N, int options)
+{
+    size_t length;
+    char *text = random_graph(seed, V, N, edges, &length);
+    int status;
+    sp_graph* graph = sp_graph_load_buffer(text, length, options, &status);
+    free(text);
+    if (graph == NULL)
+    {
+        fail("load: N=%d options=%d status=%d", N, options, status);
+    }
+    return(graph);
+}
+
+sp_graph* load_random(unsigned int seed, int N, int options)
+{
+    return(load_graph(seed, TEST_V, TEST_EDGES, N, options));
+}
+
+void state_costs(const char *text, int N, int edges, int layers, int *cost, int stride)
+{
+    // Cheapest edge between two states of a random_graph text, cost[from * stride + to] (-1 for none)
+    const char *cursor = strchr(text, '\n') + 1;
+    for (int i = 0; i < edges; i++)
+    {
+        int u = (int)strtol(cursor, (char**)&cursor, 10);
+        int v = (int)strtol(cursor, (char**)&cursor, 10);
+        int w[SP_MAX_WEIGHTS];
+        for (int j = 0; j < N; j++)
+        {
+            w[j] = (int)strtol(cursor, (char**)&cursor, 10);
+        }
+        for (int step = 0; step < layers; step++)
+        {
+            int *c = &cost[(u * layers + step) * stride + v * layers + (step + 1) % layers];
+            *c = (*c < 0 || w[step % N] < *c) ? w[step % N] : *c;
+        }
+    }
+}
+
+void check_orderings(void)
+{
+    // Every vertex ordering and block format must print the same path as the plain load
+    const int options[] = {SP_ORDER_BFS, SP_ORDER_RCM, SP_ORDER_DEGREE, SP_COMPRESS, SP_ORDER_BFS | SP_COMPRESS, SP_ORDER_RCM | SP_COMPRESS, SP_ORDER_DEGREE | SP_COMPRESS};
+    int capacity = SP_MAX_PATH(TEST_V);
+    int *expected = (int*)malloc(capacity * sizeof(int));
+    int *path = (int*)malloc(capacity * sizeof(int));
+
+    for (int N = 1; N <= SP_MAX_WEIGHTS; N++)
+    {
+        sp_graph* plain = load_random(N, N, SP_ORDER_NONE);
+        sp_query* plain_query = sp_query_create(plain);
+        for (int o = 0; o < (int)(sizeof(options) / sizeof(options[0])); o++)
+        {
+            sp_graph* graph = load_random(N, N, options[o]);
+            sp_query* query = sp_query_create(graph);
+            unsigned int seed = 7;
+            for (int q = 0; q < TEST_QUERIES; q++)
+            {
+                int source = rand_r(&seed) % TEST_V;
+                int dest = rand_r(&seed) % TEST_V;
+                int expected_distance, expected_length, distance, length;
+                sp_query_path(plain_query, source, dest, &expected_distance, expected, capacity, &expected_length);
+                sp_query_path(query, source, dest, &distance, path, capacity, &length);
+                if (distance != expected_distance || length != expected_length || memcmp(path, expected, length * sizeof(int)) != 0)
+                {
+                    fail("ordering %d: N=%d query %d %d", options[o], N, source, dest);
+                }
+            }
+            sp_query_free(query);
+            sp_graph_free(graph);
+        }
+        sp_query_free(plain_query);
+        sp_graph_free(plain);
+    }
+
+    free(expected);
+    free(path);
+}
+
+void check_range_steps(void)
+{
+    // sp_query_range reports the step phase as the weight index 0 .. N - 1 for every N, and the
+    // same distances as sp_query_path
+    int capacity = SP_MAX_PATH(TEST_V);
+    int *path = (int*)malloc(capacity * sizeof(int));
+    int vertices[TEST_V], distances[TEST_V], steps[TEST_V];
+
+    for (int N = 1; N <= SP_MAX_WEIGHTS; N++)
+    {
+        sp_graph* graph = load_random(N, N, SP_ORDER_NONE);
+        sp_query* query = sp_query_create(graph);
+        for (int source = 0; source < TEST_V; source++)
+        {
+            int count = 0;
+            sp_query_range(query, source, 1000, vertices, distances, steps, TEST_V, &count);
+            for (int i = 0; i < count; i++)
+            {
+                int distance, length;
+                sp_query_path(query, source, vertices[i], &distance, path, capacity, &length);
+                if (steps[i] < 0 || steps[i] >= N || distances[i] != distance)
+                {
+                    fail("range: N=%d %d -> %d step %d distance %d (path %d)", N, source, vertices[i], steps[i], distances[i], distance);
+                }
+            }
+        }
+        sp_query_free(query);
+        sp_graph_free(graph);
+    }
+
+    free(path);
+}
+
+void check_profile(void)
+{
+    // sp_query_profile against a reference Dijkstra over (distance, hops) labels for every start
+    // phase: the same distances and edge counts, paths of that cost, phase 0 exactly the
+    // sp_query_path path, and every phase the same path under another vertex ordering
+    int states = TEST_V * SP_MAX_WEIGHTS;
+    int capacity = SP_MAX_PATH(TEST_V);
+    int *cost = (int*)malloc((size_t)states * states * sizeof(int));
+    int *paths = (int*)malloc(SP_MAX_WEIGHTS * capacity * sizeof(int));
+    int *ordered_paths = (int*)malloc(SP_MAX_WEIGHTS * capacity * sizeof(int));
+    int *path = (int*)malloc(capacity * sizeof(int));
+    int distance[TEST_V * SP_MAX_WEIGHTS], hops[TEST_V * SP_MAX_WEIGHTS], done[TEST_V * SP_MAX_WEIGHTS];
+    int distances[SP_MAX_WEIGHTS], lengths[SP_MAX_WEIGHTS];
+    int ordered_distances[SP_MAX_WEIGHTS], ordered_lengths[SP_MAX_WEIGHTS];
+
+    for (int N = 1; N <= SP_MAX_WEIGHTS; N++)
+    {
+        size_t text_length;
+        char *text = random_graph(N, TEST_V, N, TEST_EDGES, &text_length);
+        int status;
+        sp_graph* graph = sp_graph_load_buffer(text, text_length, SP_ORDER_NONE, &status);
+        sp_graph* ordered = sp_graph_load_buffer(text, text_length, SP_ORDER_RCM | SP_COMPRESS, &status);
+        sp_query* query = sp_query_create(graph);
+        sp_query* ordered_query = sp_query_create(ordered);
+
+        int layers = (SP_MAX_WEIGHTS % N == 0) ? N : SP_MAX_WEIGHTS;
+        memset(cost, -1, (size_t)states * states * sizeof(int));
+        state_costs(text, N, TEST_EDGES, layers, cost, states);
+
+        for (int source = 0; source < TEST_PROFILE_SOURCES; source++)
+        {
+            for (int dest = 0; dest < TEST_V; dest++)
+            {
+                if (sp_query_profile(query, source, dest, distances, paths, capacity, lengths) != SP_OK ||
+                    sp_query_profile(ordered_query, source, dest, ordered_distances, ordered_paths, capacity, ordered_lengths) != SP_OK)
+                {
+                    fail("profile: N=%d query %d %d failed", N, source, dest);
+                    continue;
+                }
+
+                for (int p = 0; p < N; p++)
+                {
+                    // Reference labels from (source, step p)
+                    for (int x = 0; x < TEST_V * layers; x++)
+                    {
+                        distance[x] = SP_INF;
+                        hops[x] = 0;
+                        done[x] = 0;
+                    }
+                    distance[source * layers + p] = 0;
+                    for (;;)
+                    {
+                        int x = -1;
+                        for (int y = 0; y < TEST_V * layers; y++)
+                        {
+                            if (!done[y] && distance[y] != SP_INF && (x == -1 || distance[y] < distance[x] || (distance[y] == distance[x] && hops[y] < hops[x])))
+                            {
+                                x = y;
+                            }
+                        }
+                        if (x == -1)
+                        {
+                            break;
+                        }
+                        done[x] = 1;
+                        for (int y = 0; y < TEST_V * layers; y++)
+                        {
+                            int c = cost[x * states + y];
+                            if (c >= 0 && (distance[x] + c < distance[y] || (distance[x] + c == distance[y] && hops[x] + 1 < hops[y])))
+                            {
+                                distance[y] = distance[x] + c;
+                                hops[y] = hops[x] + 1;
+                            }
+                        }
+                    }
+
+                    // Lowest step at the minimum distance, as sp_query_path picks it
+                    int best = -1;
+                    for (int step = 0; step < layers; step++)
+                    {
+                        int x = dest * layers + step;
+                        best = (distance[x] != SP_INF && (best == -1 || distance[x] < distance[best])) ? x : best;
+                    }
+                    int expected_distance = (best == -1) ? SP_INF : distance[best];
+                    int expected_length = (best == -1) ? 0 : hops[best] + 1;
+
+                    const int *lane = paths + p * capacity;
+                    int path_cost = 0;
+                    for (int i = 1; i < lengths[p]; i++)
+                    {
+                        int c = cost[(lane[i - 1] * layers + (p + i - 1) % layers) * states + lane[i] * layers + (p + i) % layers];
+                        path_cost = (c < 0 || path_cost < 0) ? -1 : path_cost + c;
+                    }
+                    if (distances[p] != expected_distance || lengths[p] != expected_length ||
+                        (lengths[p] > 0 && (lane[0] != source || lane[lengths[p] - 1] != dest || path_cost != distances[p])))
+                    {
+                        fail("profile: N=%d phase %d query %d %d: distance %d length %d, expected %d %d", N, p, source, dest, distances[p], lengths[p], expected_distance, expected_length);
+                    }
+                    if (ordered_distances[p] != distances[p] || ordered_lengths[p] != lengths[p] ||
+                        memcmp(ordered_paths + p * capacity, lane, lengths[p] * sizeof(int)) != 0)
+                    {
+                        fail("profile: N=%d phase %d query %d %d depends on the vertex order", N, p, source, dest);
+                    }
+                }
+
+                int path_distance, path_length;
+                sp_query_path(query, source, dest, &path_distance, path, capacity, &path_length);
+                if (path_distance != distances[0] || path_length != lengths[0] || memcmp(path, paths, path_length * sizeof(int)) != 0)
+                {
+                    fail("profile: N=%d query %d %d: phase 0 differs from sp_query_path", N, source, dest);
+                }
+            }
+        }
+
+        sp_query_free(ordered_query);
+        sp_query_free(query);
+        sp_graph_free(ordered);
+        sp_graph_free(graph);
+        free(text);
+    }
+
+    free(cost);
+    free(paths);
+    free(ordered_paths);
+    free(path);
+}
+
+void check_shards(void)
+{
+    // Sharded queries must print exactly the path sp_query_path prints, for any number of shards
+    const int shard_counts[] = {1, 2, 4};
+    const int options[] = {SP_ORDER_NONE, SP_ORDER_RCM | SP_COMPRESS};
+    int capacity = SP_MAX_PATH(TEST_SHARD_V);
+    int *expected = (int*)malloc((size_t)TEST_QUERIES * capacity * sizeof(int));
+    int *path = (int*)malloc(capacity * sizeof(int));
+    int queries[TEST_QUERIES][2];
+    int expected_distance[TEST_QUERIES];
+    int expected_length[TEST_QUERIES];
+
+    unsigned int seed = 11;
+    for (int q = 0; q < TEST_QUERIES; q++)
+    {
+        queries[q][0] = rand_r(&seed) % TEST_SHARD_V;
+        queries[q][1] = rand_r(&seed) % TEST_SHARD_V;
+    }
+
+    for (int N = 1; N <= SP_MAX_WEIGHTS; N++)
+    {
+        for (int o = 0; o < (int)(sizeof(options) / sizeof(options[0])); o++)
+        {
+            sp_graph* graph = load_graph(N, TEST_SHARD_V, TEST_SHARD_EDGES, N, options[o]);
+            sp_query* query = sp_query_create(graph);
+            for (int q = 0; q < TEST_QUERIES; q++)
+            {
+                sp_query_path(query, queries[q][0], queries[q][1], &expected_distance[q], expected + (size_t)q * capacity, capacity, &expected_length[q]);
+            }
+            sp_query_free(query);
+
+            for (int k = 0; k < (int)(sizeof(shard_counts) / sizeof(shard_counts[0])); k++)
+            {
+                int status;
+                sp_shards* shards = sp_shards_start(graph, shard_counts[k], &status);
+                if (shards == NULL)
+                {
+                    fail("shards: start %d status=%d", shard_counts[k], status);
+                    continue;
+                }
+
+                for (int q = 0; q < TEST_QUERIES; q++)
+                {
+                    int distance, length;
+                    status = sp_shards_path(shards, queries[q][0], queries[q][1], &distance, path, capacity, &length);
+                    if (status != SP_OK || distance != expected_distance[q] || length != expected_length[q] ||
+                        memcmp(path, expected + (size_t)q * capacity, length * sizeof(int)) != 0)
+                    {
+                        fail("shards %d: N=%d options=%d query %d %d", shard_counts[k], N, options[o], queries[q][0], queries[q][1]);
+                    }
+                }
+                sp_shards_stop(shards);
+            }
+            sp_graph_free(graph);
+        }
+    }
+
+    // Two live sets: stopping either must not wait on workers of the other (which hold no copy of
+    // its channels). Runs in a child with an alarm, in its own process group as check_dead_worker.
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        setpgid(0, 0);
+        alarm(20);
+        sp_graph* graph = load_graph(1, TEST_SHARD_V, TEST_SHARD_EDGES, 3, SP_ORDER_NONE);
+        sp_query* query = sp_query_create(graph);
+        int status;
+        int ok = 1;
+        for (int first = 0; first < 2; first++)
+        {
+            sp_shards* sets[2];
+            sets[0] = sp_shards_start(graph, 2, &status);
+            sets[1] = sp_shards_start(graph, 2, &status);
+            ok = ok && sets[0] != NULL && sets[1] != NULL;
+            for (int i = 0; i < 2 && ok; i++)
+            {
+                int set = (first + i) % 2;
+                int distance, length, serial_distance, serial_length;
+                sp_query_path(query, 0, 1, &serial_distance, expected, capacity, &serial_length);
+                ok = (sp_shards_path(sets[set], 0, 1, &distance, path, capacity, &length) == SP_OK &&
+                      distance == serial_distance && length == serial_length &&
+                      memcmp(path, expected, length * sizeof(int)) == 0);
+                sp_shards_stop(sets[set]); // The other set stays live
+            }
+        }
+        sp_query_free(query);
+        sp_graph_free(graph);
+        _exit(ok ? 0 : 1);
+    }
+
+    int code = 0;
+    setpgid(pid, pid);
+    waitpid(pid, &code, 0);
+    kill(-pid, SIGKILL);
+    if (!WIFEXITED(code) || WEXITSTATUS(code) != 0)
+    {
+        fail("shards: two sets: %s", WIFSIGNALED(code) ? "sp_shards_stop hung" : "wrong path");
+    }
+
+    free(expected);
+    free(path);
+}
+
+void check_ooc(void)
+{
+    // Out-of-core queries must print exactly the path sp_query_path prints, with either store
+    // order and with a cache large enough for the graph or too small for one block
+    const int orders[] = {SP_ORDER_NONE, SP_ORDER_DEGREE};
+    const size_t cache_bytes[] = {(size_t)1 << 20, 1};
+    int capacity = SP_MAX_PATH(TEST_SHARD_V);
+    int *expected = (int*)malloc(capacity * sizeof(int));
+    int *path = (int*)malloc(capacity * sizeof(int));
+    char graph_file[] = "/tmp/sp_test_graph_XXXXXX";
+    char store_file[] = "/tmp/sp_test_store_XXXXXX";
+    int graph_fd = mkstemp(graph_file);
+    int store_fd = mkstemp(store_file);
+    if (graph_fd < 0 || store_fd < 0)
+    {
+        fail("ooc: cannot create temporary files");
+        return;
+    }
+    close(store_fd);
+
+    for (int N = 1; N <= SP_MAX_WEIGHTS; N++)
+    {
+        size_t text_length;
+        char *text = random_graph(N, TEST_SHARD_V, N, TEST_SHARD_EDGES, &text_length);
+        if (ftruncate(graph_fd, 0) != 0 || pwrite(graph_fd, text, text_length, 0) != (ssize_t)text_length)
+        {
+            fail("ooc: cannot write the graph file");
+            free(text);
+            continue;
+        }
+        int status;
+        sp_graph* graph = sp_graph_load_buffer(text, text_length, SP_ORDER_NONE, &status);
+        sp_query* query = sp_query_create(graph);
+        free(text);
+
+        for (int o = 0; o < (int)(sizeof(orders) / sizeof(orders[0])); o++)
+        {
+            status = sp_ooc_build(graph_file, store_file, orders[o]);
+            if (status != SP_OK)
+            {
+                fail("ooc: N=%d build order %d status=%d", N, orders[o], status);
+                continue;
+            }
+
+            for (int c = 0; c < (int)(sizeof(cache_bytes) / sizeof(cache_bytes[0])); c++)
+            {
+                sp_ooc* ooc = sp_ooc_open(store_file, cache_bytes[c], &status);
+                if (ooc == NULL)
+                {
+                    fail("ooc: N=%d open order %d status=%d", N, orders[o], status);
+                    continue;
+                }
+
+                unsigned int seed = 13;
+                for (int q = 0; q < TEST_QUERIES; q++)
+                {
+                    int source = rand_r(&seed) % TEST_SHARD_V;
+                    int dest = rand_r(&seed) % TEST_SHARD_V;
+                    int expected_distance, expected_length, distance, length;
+                    sp_io_stats io;
+                    sp_query_path(query, source, dest, &expected_distance, expected, capacity, &expected_length);
+                    status = sp_ooc_path(ooc, source, dest, &distance, path, capacity, &length, &io);
+                    if (status != SP_OK || distance != expected_distance || length != expected_length ||
+                        memcmp(path, expected, length * sizeof(int)) != 0)
+                    {
+                        fail("ooc: N=%d order %d cache %zu query %d %d", N, orders[o], cache_bytes[c], source, dest);
+                    }
+                }
+                sp_ooc_close(ooc);
+            }
+        }
+
+        sp_query_free(query);
+        sp_graph_free(graph);
+    }
+
+    close(graph_fd);
+    unlink(graph_file);
+    unlink(store_file);
+    free(expected);
+    free(path);
+}
+
+typedef struct
+{
+    int layers; // Step layers per vertex
+    int cost[TEST_K_STATES][TEST_K_STATES]; // Cheapest edge between two states (-1 for none)
+    int bound[TEST_K_STATES]; // Distance to the destination without passing it (-1 if it cannot reach it)
+    int on_path[TEST_K_STATES];
+    int dest;
+    int best[TEST_K]; // Cheapest path costs found so far, ascending
+    int found;
+} KEnumeration;
+
+void enumerate_paths(KEnumeration* e, int state, int cost)
+{
+    // Depth-first over loopless state paths, pruned once a path cannot enter the TEST_K cheapest
+    if (e->found == TEST_K && cost + e->bound[state] >= e->best[TEST_K - 1])
+    {
+        return;
+    }
+
+    if (state / e->layers == e->dest)
+    {
+        int i = (e->found < TEST_K) ? (e->found)++ : TEST_K - 1;
+        for (; i > 0 && e->best[i - 1] > cost; i--)
+        {
+            e->best[i] = e->best[i - 1];
+        }
+        e->best[i] = cost;
+        return; // Paths end at their first visit to the destination
+    }
+
+    e->on_path[state] = 1;
+    for (int next = 0; next < TEST_K_V * e->layers; next++)
+    {
+        if (e->cost[state][next] >= 0 && e->bound[next] >= 0 && !e->on_path[next])
+        {
+            enumerate_paths(e, next, cost + e->cost[state][next]);
+        }
+    }
+    e->on_path[state] = 0;
+}
+
+void check_k_paths(void)
+{
+    // sp_query_k_paths against an exhaustive enumeration of the loopless state paths: the same
+    // costs, valid and distinct paths, and the same result with one thread and with four
+    KEnumeration* e = (KEnumeration*)malloc(sizeof(KEnumeration));
+    int capacity = SP_MAX_PATH(TEST_K_V);
+    int *paths[2];
+    int distances[2][TEST_K], lengths[2][TEST_K], count[2];
+    paths[0] = (int*)malloc(TEST_K * capacity * sizeof(int));
+    paths[1] = (int*)malloc(TEST_K * capacity * sizeof(int));
+    const int threads[2] = {1, 4};
+
+    for (int N = 1; N <= SP_MAX_WEIGHTS; N++)
+    {
+        size_t text_length;
+        char *text = random_graph(N, TEST_K_V, N, TEST_K_EDGES, &text_length);
+        int status;
+        sp_graph* graph = sp_graph_load_buffer(text, text_length, SP_ORDER_NONE, &status);
+        sp_query* query = sp_query_create(graph);
+
+        // The state graph, parallel edges collapsed to the cheapest
+        int layers = (SP_MAX_WEIGHTS % N == 0) ? N : SP_MAX_WEIGHTS;
+        int states = TEST_K_V * layers;
+        e->layers = layers;
+        memset(e->cost, -1, sizeof(e->cost));
+        state_costs(text, N, TEST_K_EDGES, layers, &e->cost[0][0], TEST_K_STATES);
+
+        unsigned int seed = 3;
+        for (int q = 0; q < TEST_QUERIES; q++)
+        {
+            int source = rand_r(&seed) % TEST_K_V;
+            int dest = rand_r(&seed) % TEST_K_V;
+
+            // Bellman-Ford towards the destination, never through it
+            e->dest = dest;
+            for (int x = 0; x < states; x++)
+            {
+                e->bound[x] = (x / layers == dest) ? 0 : -1;
+                e->on_path[x] = 0;
+            }
+            for (int changed = 1; changed; )
+            {
+                changed = 0;
+                for (int x = 0; x < states; x++)
+                {
+                    for (int y = 0; y < states && x / layers != dest; y++)
+                    {
+                        if (e->cost[x][y] >= 0 && e->bound[y] >= 0 && (e->bound[x] < 0 || e->bound[y] + e->cost[x][y] < e->bound[x]))
+                        {
+                            e->bound[x] = e->bound[y] + e->cost[x][y];
+                            changed = 1;
+                        }
+                    }
+                }
+            }
+            e->found = 0;
+            if (e->bound[source * layers] >= 0)
+            {
+                enumerate_paths(e, source * layers, 0);
+            }
+
+            for (int t = 0; t < 2; t++)
+            {
+                sp_query_set_threads(query, threads[t]);
+                status = sp_query_k_paths(query, source, dest, TEST_K, distances[t], paths[t], capacity, lengths[t], &count[t]);
+                if (status != SP_OK || count[t] != e->found)
+                {
+                    fail("k paths: N=%d threads=%d query %d %d: %d paths, expected %d", N, threads[t], source, dest, count[t], e->found);
+                    continue;
+                }
+
+                for (int p = 0; p < count[t]; p++)
+                {
+                    // Costs match the enumeration; each path is a valid loopless walk ending at its first visit to dest
+                    const int *path = paths[t] + p * capacity;
+                    int cost = 0;
+                    int valid = (distances[t][p] == e->best[p] && path[0] == source && path[lengths[t][p] - 1] == dest);
+                    memset(e->on_path, 0, sizeof(e->on_path));
+                    for (int i = 0; i < lengths[t][p] && valid; i++)
+                    {
+                        int state = path[i] * layers + i % layers;
+                        valid = !e->on_path[state] && (path[i] != dest || i == lengths[t][p] - 1);
+                        e->on_path[state] = 1;
+                        if (valid && i > 0)
+                        {
+                            int c = e->cost[path[i - 1] * layers + (i - 1) % layers][state];
+                            valid = (c >= 0);
+                            cost += c;
+                        }
+                    }
+                    for (int other = 0; other < p && valid; other++)
+                    {
+                        valid = (lengths[t][other] != lengths[t][p] || memcmp(paths[t] + other * capacity, path, lengths[t][p] * sizeof(int)) != 0);
+                    }
+                    if (!valid || cost != distances[t][p])
+                    {
+                        fail("k paths: N=%d threads=%d query %d %d: path %d invalid", N, threads[t], source, dest, p);
+                    }
+                }
+            }
+            memset(e->on_path, 0, sizeof(e->on_path));
+
+            if (count[0] == count[1])
+            {
+                for (int p = 0; p < count[0]; p++)
+                {
+                    if (lengths[0][p] != lengths[1][p] || memcmp(paths[0] + p * capacity, paths[1] + p * capacity, lengths[0][p] * sizeof(int)) != 0)
+                    {
+                        fail("k paths: N=%d query %d %d: path %d depends on the thread count", N, source, dest, p);
+                    }
+                }
+            }
+        }
+
+        sp_query_free(query);
+        sp_graph_free(graph);
+        free(text);
+    }
+
+    free(paths[0]);
+    free(paths[1]);
+    free(e);
+}
+
+void check_dead_worker(void)
+{
+    // A shard worker that dies must turn into SP_ERR_WORKER, not a coordinator that waits forever.
+    // Runs in a child with an alarm, in its own process group so that no worker outlives the check;
+    // the workers are found through /proc (skipped without it).
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        setpgid(0, 0);
+        alarm(20);
+        sp_graph* graph = load_graph(1, TEST_SHARD_V, TEST_SHARD_EDGES, 3, SP_ORDER_NONE);
+        int status;
+        sp_shards* shards = sp_shards_start(graph, 3, &status);
+        char name[64];
+        snprintf(name, sizeof(name), "/proc/self/task/%d/children", (int)getpid());
+        FILE *children = fopen(name, "r");
+        int worker = 0;
+        if (shards == NULL || children == NULL || fscanf(children, "%d", &worker) != 1)
+        {
+            _exit(children == NULL ? 0 : 1);
+        }
+        fclose(children);
+
+        int distance, length;
+        int path[SP_MAX_PATH(TEST_SHARD_V)];
+        int ok = (sp_shards_path(shards, 0, 1, &distance, path, SP_MAX_PATH(TEST_SHARD_V), &length) == SP_OK);
+        kill(worker, SIGKILL);
+        ok = ok && (sp_shards_path(shards, 0, 1, &distance, path, SP_MAX_PATH(TEST_SHARD_V), &length) == SP_ERR_WORKER);
+        ok = ok && (sp_shards_path(shards, 1, 0, &distance, path, SP_MAX_PATH(TEST_SHARD_V), &length) == SP_ERR_WORKER);
+        sp_shards_stop(shards);
+        sp_graph_free(graph);
+        _exit(ok ? 0 : 1);
+    }
+
+    int code = 0;
+    setpgid(pid, pid);
+    waitpid(pid, &code, 0);
+    kill(-pid, SIGKILL);
+    if (!WIFEXITED(code) || WEXITSTATUS(code) != 0)
+    {
+        fail("dead worker: %s", WIFSIGNALED(code) ? "coordinator hung" : "no SP_ERR_WORKER");
+    }
+}
+
+void check_out_of_memory(void)
+{
+    // A graph that does not fit must fail to load with SP_ERR_MEMORY, not end the process.
+    // Runs in a child whose address space is capped.
+    const int options[] = {SP_ORDER_NONE, SP_ORDER_DEGREE, SP_COMPRESS, SP_ORDER_RCM | SP_COMPRESS};
+    for (int o = 0; o < (int)(sizeof(options) / sizeof(options[0])); o++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            struct rlimit limit = {(rlim_t)256 << 20, (rlim_t)256 << 20};
+            setrlimit(RLIMIT_AS, &limit);
+            const char *text = "100000000 3\n0 1 1 2 3\n";
+            int status = SP_OK;
+            sp_graph* graph = sp_graph_load_buffer(text, strlen(text), options[o], &status);
+            _exit((graph == NULL && status == SP_ERR_MEMORY) ? 0 : 1);
+        }
+
+        int code = 0;
+        waitpid(pid, &code, 0);
+        if (!WIFEXITED(code) || WEXITSTATUS(code) != 0)
+        {
+            fail("out of memory %d: load did not return SP_ERR_MEMORY", options[o]);
+        }
+    }
+}
+
+int main(void)
+{
+    check_orderings();
+    check_range_steps();
+    check_profile();
+    check_shards();
+    check_ooc();
+    check_k_paths();
+    check_dead_worker();
+    check_out_of_memory();
+
+    if (failures > 0)
+    {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return(EXIT_FAILURE);
+    }
+
+    printf("All checks passed\n");
+    return(EXIT_SUCCESS);
+}